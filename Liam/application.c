@@ -93,6 +93,7 @@ void playMelody(MusicPlayer* self, int unused) {
 
     Tone** melody;
     ToneGenerator* voice;
+    Batch batch = initBatch(); // all messages of this beat are sent together
 
     // Configure tone generator
     for (int i = 0; i < 4; i++) {
@@ -107,11 +108,12 @@ void playMelody(MusicPlayer* self, int unused) {
         SYNC(voice, setPeriod, currentPeriod);
         SYNC(voice, enablePlay, 0);
         
-        BEFORE(MSEC(1), voice, start, 1); // Start tone
-        SEND(beatLength*toneLength - MSEC(50), MSEC(1), voice, stop, 0); // End tone
+        BATCH_SEND(&batch, 0, MSEC(1), voice, start, 1); // Start tone
+        BATCH_SEND(&batch, beatLength*toneLength - MSEC(50), MSEC(1), voice, stop, 0); // End tone
     }
     
-    SEND(beatLength, MSEC(1), self, playMelody, 0); // Call to play next note in melody
+    BATCH_SEND(&batch, beatLength, MSEC(1), self, playMelody, 0); // Call to play next note in melody
+    BATCH_SUBMIT(&batch);
 
     // Increment melody index
     self->currentMelodyIndex = (self->currentMelodyIndex + 1) % 16;
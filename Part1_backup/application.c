@@ -86,7 +86,7 @@ void toggleToneDeadline(Tone*, int);
 void toggleWorkDeadline(Work*, int);
 void setWork(Work*, int);
 
-long average(long*);
+long average(long*, int);
 
 // Function Definitions
 
@@ -238,16 +238,15 @@ volatile void runTest(App *self, int arg) {
             max = diff;
     }
 
-    long avg = average(time_arr);
+    long avg = average(time_arr, 500);
 
     snprintf(results, 48, "Results - Max: %ld, Avg: %ld\n", max, avg);
     SCI_WRITE(&sci0, results);
 
 }
 
-long average(long *arr){
+long average(long *arr, int arr_size){
     long sum = 0;
-    size_t arr_size = sizeof(arr) / sizeof(arr[0]);
     for(int i = 0; i < arr_size; i++){
         sum += arr[i];
     }
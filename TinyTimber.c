@@ -1,808 +1,2251 @@
-// The Timber compiler <timber-lang.org>
-// 
-// Copyright 2008-2012 Johan Nordlander <nordland@csee.ltu.se>
-// All rights reserved.
-// 
-// Redistribution and use in source and binary forms, with or without
-// modification, are permitted provided that the following conditions
-// are met:
-// 
-// 1. Redistributions of source code must retain the above copyright
-//    notice, this list of conditions and the following disclaimer.
-// 
-// 2. Redistributions in binary form must reproduce the above copyright
-//    notice, this list of conditions and the following disclaimer in the
-//    documentation and/or other materials provided with the distribution.
-// 
-// 3. Neither the names of the copyright holder and any identified
-//    contributors, nor the names of their affiliations, may be used to 
-//    endorse or promote products derived from this software without 
-//    specific prior written permission.
-// 
-// THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS ``AS IS'' AND ANY EXPRESS
-// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
-// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
-// DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR
-// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
-// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
-// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
-// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
-// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
-// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
-// POSSIBILITY OF SUCH DAMAGE.
-
-/*
- * 
- * TinyTimber.c
- *
- */
-
-#include "TinyTimber.h"
-#include "stm32f4xx.h"
-#include "stm32f4xx_gpio.h"
-#include "stm32f4xx_usart.h"
-#include "stm32f4xx_tim.h"
-#include "stm32f4xx_rcc.h"
-
-void DUMPC(char);
-
-void DUMP(char *s) {
-  while (*s) {
-	if (*s != '\r')
-		DUMPC(*s++);
-	else
-		s++;
-  }
-}
-
-char hex[] = "0123456789ABCDEF";
-
-void DUMPH(unsigned int val) {
-    char buf[8];
-    int i = 0;
-    do {
-        buf[i++] = hex[val & 0x0F];
-        val = val >> 4;
-    } while (val);
-    while (i)
-        DUMPC(buf[--i]);
-}
-
-void DUMPD(int val) {
-    char buf[100];
-	
-	int sign = val < 0 ? -1 : 1;
-	
-	val = val * sign;
-		
-    int i = 0;
-    do {
-        buf[i++] = hex[val % 10];
-        val = val / 10;
-    } while (val);
-	if (sign < 0)
-		DUMPC('-');
-    while (i)
-        DUMPC(buf[--i]);
-
-}
-
-// Cortex m4 dependencies
-
-#define __CURRENT_PRIORITY ((__get_BASEPRI() >> (8 - __NVIC_PRIO_BITS)))
-
-void sei( void)			{ __set_BASEPRI(__DISABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
-void cli( void)			{ __set_BASEPRI(__ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
-
-#define PROTECTED()		(__CURRENT_PRIORITY == __DISABLED_PRIORITY)	
-
-#define __CURRENT_EXCEPTION (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk)
-
-#define THREADMODE()	(__CURRENT_EXCEPTION == 0)
-
-#define ENABLED()      	(!PROTECTED())
-#define DISABLE()      	{ sei(); }
-#define ENABLE(s)	    { if (s) cli(); }
-#define SLEEP()         { __asm volatile ("     wfi\n"); }
-
-#define RED_ALERT()     { GPIO_WriteBit(GPIOB, GPIO_Pin_1, (BitAction) 0); }  // Red LED On
-
-#define PANIC(s)         { DUMP("PANIC!!! "); RED_ALERT(); DUMP(s); while (1) SLEEP(); }
-
-#ifdef __USE_LOCAL_SBRK
-//register char *__stack_ptr asm ("sp");
-
-char *__heap_end;
-
-void *_sbrk (int incr)
-{
-	extern char   end; /* Set by linker.  */
-	char *        prev_heap_end;
-
-	DUMP("NOTE: _sbrk in use!\n\r");
-
-	if (__heap_end == 0)
-     __heap_end = & end;
-
-	prev_heap_end = __heap_end;
-   
-//	if (__heap_end + incr > __stack_ptr) // will fail if stacks[0]-stacks[3] is used
-//		PANIC("_sbrk: Heap and stack collision\r\n");
-
-	__heap_end += incr;
-
-	return (void *) prev_heap_end;
-}
-#endif
-
-#define NMSGS           30
-#define NTHREADS        4
-
-#define CONTEXTSIZE		(2+16+8+16+10)
-
-#define CONTEXT_T uint32_t
-
-#define STACKSIZE       1024
-
-#define STACK_T long long
-
-struct stack;
-
-/*
- * Context:
- * 
- * FPSCR + fill	(2 words)	(OFFSET = 50-51)
- * S15-S0		(16 words)	(OFFSET = 34-49)
- * xPSR,					(OFFSET = 33) 
- * PC,						(OFFSET = 32)
- * LR, 						(OFFSET = 31)
- * R12,						(OFFSET = 30)
- * R3-R0		(8 words)	(OFFSET = 26-29)
- * S31-S16		(16 words)	(OFFSET = 10-25)
- * R11-R4,					(OFFSET = 2-9)
- * BASEPRI,					(OFFSET = 1)
- * EXC_RETURN	(10 words)	(OFFSET = 0)
- */
-
-#define	CONTEXT_xPSR_OFF	33
-#define	CONTEXT_PC_OFF		32
-#define	CONTEXT_BASEPRI_OFF	1
-#define	CONTEXT_EXC_OFF		0
-
-#define HW32_REG(ADDRESS) (*((volatile unsigned long *)(ADDRESS)))
- 
-#define SETCONTEXT(c)	
-
-void SETSTACK(CONTEXT_T *cp, struct stack *sp) {
-	*cp = ((CONTEXT_T) sp) + STACKSIZE*sizeof(STACK_T) - CONTEXTSIZE*sizeof(CONTEXT_T);
-	
-	CONTEXT_T ci = *cp;
-	int i;
-	for (i=0; i<CONTEXTSIZE;i++)
-		HW32_REG(ci + (i<<2)) = 0;
-	HW32_REG(ci + (CONTEXT_EXC_OFF<<2)) = 0xFFFFFFE9;
-	HW32_REG(ci + (CONTEXT_BASEPRI_OFF<<2)) = __ENABLED_PRIORITY;
-	HW32_REG(ci + (CONTEXT_xPSR_OFF<<2)) = 0x01000000;
-}
-
-void SETPC(CONTEXT_T *cp, void (*fp)(void)) {
-	CONTEXT_T pc_p = *cp + (CONTEXT_PC_OFF<<2);
-	HW32_REG(pc_p) = (unsigned long) fp;
-}
-
-#define	PendSV_IRQ_VECTOR		(0x2001C000+0x38)
-#define PendSV_Exception		void vect_PendSV( void ) 
-
-PendSV_Exception;
-
-#define	SVCall_IRQ_VECTOR		(0x2001C000+0x2C)
-#define SVCall_Exception		void vect_SVCall( void ) 
-
-SVCall_Exception;
-
-#define	TIM5_IRQ_VECTOR			(0x2001C000+0x108)
-#define TIMER_COMPARE_INTERRUPT void vect_TIM5( void ) 
-
-TIMER_COMPARE_INTERRUPT;
-
-void TIMER_INIT() {
-	TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;	
-
-/*
-	Default values:
-        (++) Autoreload value = 0xFFFFFFFF
-        (++) Prescaler value = 0x0000
-        (++) Counter mode = Up counting
-        (++) Clock Division = TIM_CKD_DIV1
- */
-
-	TIM_DeInit(TIM5);
-	
-	TIM_TimeBaseStructInit(&TIM_TimeBaseInitStructure);
-	TIM_TimeBaseInitStructure.TIM_Prescaler = __TIMER_PRESCALE;
-	TIM_TimeBaseInit(TIM5, &TIM_TimeBaseInitStructure);
-
-	*((void (**)(void) ) PendSV_IRQ_VECTOR ) = vect_PendSV;
-
-	NVIC_SetPriority(PendSV_IRQn, __IRQ_PRIORITY); // same priority as timer and USART1
-
-	*((void (**)(void) ) SVCall_IRQ_VECTOR ) = vect_SVCall;
-
-	NVIC_SetPriority(SVCall_IRQn, 0x00); // highest priority
-
-	*((void (**)(void) ) TIM5_IRQ_VECTOR ) = vect_TIM5;
-
-	NVIC_SetPriority( TIM5_IRQn, __IRQ_PRIORITY); 
-	NVIC_EnableIRQ( TIM5_IRQn);
-
-	TIM_SetCounter(TIM5, 0);	
-	TIM_Cmd( TIM5, ENABLE);
-
-	TIM_ITConfig( TIM5, TIM_IT_CC1, ENABLE);	
-}
-
-#define TIMER_CCLR()    { TIM_ClearITPendingBit(TIM5, TIM_IT_CC1); }  // Timer compare interrupt clear
-
-#define TIMERGET(x)		(x = TIM_GetCounter(TIM5))
-
-#define TIMERSET(x)		(TIM_SetCompare1(TIM5, x->baseline))
-
-#define INFINITY        0x7fffffffL
-
-void DUMPC(char c) {
-   USART_SendData(USART1, c );
-   while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);    
-}
-
-// End of target dependencies
-
-typedef struct thread_block *Thread;
-
-#define INSTALLED_TAG (Thread)1
-
-struct msg_block {
-    Msg next;                // for use in linked lists
-    Time baseline;           // event time reference point
-    Time deadline;           // absolute deadline (=priority)
-    Object *to;              // receiving object
-    Method method;           // code to run
-    int arg;                 // argument to the above
-};
-
-struct thread_block {
-	CONTEXT_T context;     	 // machine state */
-	int thread_no;
-    Thread next;             // for use in linked lists
-    Msg msg;                 // message under execution
-    Object *waitsFor;        // deadlock detection link
-};
-
-struct stack {
-    STACK_T stack[STACKSIZE];
-};
-
-struct msg_block    messages[NMSGS];
-struct thread_block threads[NTHREADS];
-struct stack        stacks[NTHREADS];
-
-struct thread_block thread0;
-
-Msg msgPool         = messages;
-Msg msgQ            = NULL;
-Msg timerQ          = NULL;
-int runAsHardware	= 0;
-int doIRQSchedule	= 0;
-Time timestamp      = 0;
-int overflows       = 0;
-
-Thread threadPool   = threads;
-Thread activeStack  = &thread0;
-Thread current      = &thread0;
-Thread upcoming;
-
-Method  mtable[N_VECTORS];
-Object *otable[N_VECTORS];
-
-static void dispatch( Thread);
-static void schedule( void);
-
-// Cortex m4 dependencies
-
-#define	    USART1_IRQ_VECTOR		(0x2001C000+0xD4)
-#define	    CAN1_IRQ_VECTOR			(0x2001C000+0x90)
-#define	    EXTI9_5_IRQ_VECTOR		(0x2001C000+0x9C)
-
-#ifdef	__TRACE_SCHEDULE
-#define IRQ(n,v) void v (void) { \
-        DISABLE(); TIMERGET(timestamp); runAsHardware = 1; doIRQSchedule = 0; \
-        if (mtable[n]) mtable[n](otable[n],n); \
-		DUMP("schedule() in IRQ()"); DUMP("\n\r"); \
-        runAsHardware = 0; if (doIRQSchedule) schedule(); doIRQSchedule = 0; ENABLE(1); \
-}
-#else
-#define IRQ(n,v) void v (void) { \
-        TIMERGET(timestamp); runAsHardware = 1; doIRQSchedule = 0; \
-        if (mtable[n]) mtable[n](otable[n],n); \
-		runAsHardware = 0; if (doIRQSchedule) schedule(); doIRQSchedule = 0; \
-}
-#endif
-
-IRQ(IRQ_USART1,		vect_USART1);
-IRQ(IRQ_CAN1,		vect_CAN1);
-IRQ(IRQ_EXTI9_5,	vect_EXTI9_5);
-
-// End of target dependencies
-
-/* queue manager */
-void enqueueByDeadline(Msg p, Msg *queue) {
-    Msg prev = NULL, q = *queue;
-    while (q && (q->deadline <= p->deadline)) {
-        prev = q;
-        q = q->next;
-    }
-    p->next = q;
-    if (prev == NULL)
-        *queue = p;
-    else
-        prev->next = p;
-}
-
-void enqueueByBaseline(Msg p, Msg *queue) {
-    Msg prev = NULL, q = *queue;
-    while (q && (q->baseline <= p->baseline )) {
-        prev = q;
-        q = q->next;
-    }
-    p->next = q;
-    if (prev == NULL)
-        *queue = p;
-    else
-        prev->next = p;
-}
-
-Msg dequeue(Msg *queue) {
-    Msg m = *queue;
-    if (m)
-        *queue = m->next;
-    else
-        PANIC("Empty queue");  // Empty queue, kernel panic!!!
-    return m;
-}
-
-Msg dequeue_pool(Msg *queue) {
-    Msg m = *queue;
-    if (m)
-        *queue = m->next;
-    else
-        PANIC("Empty pool");  // Empty pool, kernel panic!!!
-    return m;
-}
-
-void insert(Msg m, Msg *queue) {
-    m->next = *queue;
-    *queue = m;
-}
-
-void push(Thread t, Thread *stack) {
-    t->next = *stack;
-    *stack = t;
-}
-
-Thread pop(Thread *stack) {
-    Thread t = *stack;
-    *stack = t->next;
-    return t;
-}
-
-static int remove(Msg m, Msg *queue) {
-    Msg prev = NULL, q = *queue;
-    while (q && (q != m)) {
-        prev = q;
-        q = q->next;
-    }
-    if (q) {
-        if (prev)
-            prev->next = q->next;
-        else
-            *queue = q->next;
-        return 1;
-    }
-    return 0;
-}
-
-TIMER_COMPARE_INTERRUPT {
-    Time now;
- 
- 	TIMER_CCLR();
-#ifdef	__USE_SAFE_TIMER
-	TIM_Cmd( TIM5, DISABLE);
-#endif
-    TIMERGET(now);
-	
-#ifdef	__TRACE_TIMER1
-	DUMP("In TIMER_COMPARE_INTERRUPT()!");
- 	DUMP(" Counter = ");
-    DUMPD(TIM_GetCounter(TIM5));
-    DUMP(", Exception = ");
-    DUMPD(__CURRENT_EXCEPTION);
-    DUMP(", timerQ = ");
-    DUMPH((unsigned int) timerQ);
-	DUMP("\n\r");
-#endif
-
-    while (timerQ && (timerQ->baseline - now <= 0))
-        enqueueByDeadline( dequeue(&timerQ), &msgQ );
-    if (timerQ) {
-#ifdef	__USE_FUTURE_CHECK_TIMER
-		Time timcount = TIM_GetCounter(TIM5);
-		if (timerQ->baseline < timcount)
-			RED_ALERT();    // Next event is in the past!
-#endif
-		TIMERSET(timerQ);		
-	}
-#ifdef	__TRACE_SCHEDULE
-	DUMP("schedule() in TIMER_COMPARE_INTERRUPT()");
-	DUMP("\n\r");
-#endif
-#ifdef	__USE_SAFE_TIMER
-	TIM_Cmd( TIM5, ENABLE);
-#endif
-	
-    schedule();
-}
-
-/* context switching */
-
-__attribute__((naked)) 
-void __svc_dispatch( Thread next ) {
-	upcoming = next;
-	asm volatile(
-		"svc 0x10\n"
-		"mov pc, lr\n"
-	);
-}
-
-__attribute__((naked)) 
-void __pendSV_dispatch( Thread next ) {
-	upcoming = next;
-	SCB->ICSR |= (1<<28); // SCB_ICSR_PENDSVSET_Msk
-	asm volatile(
-		"mov pc, lr\n"
-	);
-}
-
-void dispatch( Thread next ) {
-#ifdef	__TRACE_DISPATCH
-		DUMP("Entered dispatch(): ");
-		DUMP("thread #");
-		DUMPD(next->thread_no);
-		DUMP(", mode = ");
-		DUMPD(__CURRENT_EXCEPTION);
-		DUMP("\n\r");
-#endif
-	
-	if (THREADMODE()) {
-		__svc_dispatch( next);	
-	}
-	else {
-		__pendSV_dispatch( next);
-	}
-
-	ENABLE(1);
-}
-
-static void run(void) {
-    while (1) {
-#ifdef	__TRACE_RUN
-		DUMP("Entered run(): ");
-		DUMP("thread #");
-		DUMPD(current->thread_no);
-		DUMP(", Exception = ");
-		DUMPD(__CURRENT_EXCEPTION);
-		DUMP("\n\r");
-#endif
-
-        Msg this = current->msg = dequeue(&msgQ); // Get first pending message
-        Msg oldMsg;
-        
-#ifdef	__TRACE_RUN
-		DUMP("Dequeue in run() done:");
-		DUMP("thread #");
-		DUMPD(current->thread_no);
-		DUMP(", method = ");
-		DUMPH((unsigned int) this->method);
-		DUMP("\n\r");
-#endif
-
-        ENABLE(1);
-        SYNC(this->to, this->method, this->arg);
-        DISABLE();
-
-        insert(this, &msgPool);
-       
-        oldMsg = activeStack->next->msg;
-        if (!msgQ || (oldMsg && (msgQ->deadline - oldMsg->deadline > 0))) {
-            Thread t;
-            push(pop(&activeStack), &threadPool);
-            t = activeStack;  // can't be NULL, may be &thread0
-            while (t->waitsFor) 
-	            t = t->waitsFor->ownedBy;
-#ifdef	__TRACE_DISPATCH
-			DUMP("dispatch() in run()");
-			DUMP("\n\r");
-#endif
-            dispatch(t);
-        }
-	}
-}
-
-static void idle(void) {
-#ifdef	__TRACE_SCHEDULE
-	DUMP("schedule() in idle()");
-	DUMP("\n\r");
-#endif
-    schedule();
-    while (1) {
-		ENABLE(1);
-		SLEEP();
-    }
-}
-
-static void schedule(void) {
-    Msg topMsg = activeStack->msg;
-
-#ifdef	__TRACE_SCHEDULE
-		DUMP("Entered schedule(): ");
-		DUMP("msgQ = ");
-		DUMPH((unsigned int) msgQ);
-		DUMP(", topMsg = ");
-		DUMPH((unsigned int) topMsg);
-		DUMP("\n\r");
-#endif
- 
-    if (msgQ && threadPool && ((!topMsg) || (msgQ->deadline - topMsg->deadline < 0))) {
-        push(pop(&threadPool), &activeStack);
-
-#ifdef	__TRACE_DISPATCH
-		DUMP("dispatch() in schedule()");
-		DUMP("\n\r");
-#endif
-        dispatch(activeStack);
-    }
-}
-
-/* communication primitives */
-Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
-    Msg m;
-    Time now;
-    char wasEnabled = ENABLED();
-    DISABLE();
-    m = dequeue_pool(&msgPool); // Get new message template
-    m->to = to; 
-    m->method = meth; 
-    m->arg = arg;
-	m->baseline = (runAsHardware ? timestamp : current->msg->baseline) + bl;
-    m->deadline = m->baseline + (dl > 0 ? dl : INFINITY);
-    
-#ifdef	__USE_SAFE_TIMER
-	TIM_Cmd( TIM5, DISABLE);
-#endif
-    TIMERGET(now);
-
-/*	DUMP("Entered async(): ");
-	DUMP("bl = ");
-	DUMPD(m->baseline);
-	DUMP(", dl = ");
-	DUMPD(m->deadline);
-	DUMP(", now = ");
-	DUMPD(now);
-	DUMP(", wasEnabled = ");
-	DUMPD(wasEnabled);
-	DUMP(", runAsHardware = ");
-	DUMPD(runAsHardware);
-	DUMP("\n\r"); */
-
-    if (m->baseline - now > 0) {        // baseline has not yet passed
-#ifdef	__TRACE_ASYNC1
-		DUMP("enqueueByBaseline() in async()");
-		DUMP("\n\r");
-#endif
-        enqueueByBaseline(m, &timerQ);
-#ifdef	__USE_FUTURE_CHECK_TIMER
-		if (timerQ->baseline < now)
-			RED_ALERT();    // Next event is in the past!
-#endif			
-        TIMERSET(timerQ);
-
-#ifdef	__USE_SAFE_TIMER
-		TIM_Cmd( TIM5, ENABLE);
-#endif
-    } else {                            // m is immediately schedulable
-#ifdef	__TRACE_ASYNC1
- 		DUMP("enqueueByDeadline() in async()");
-		DUMP("\n\r");
-#endif
-#ifdef	__USE_SAFE_TIMER
-		TIM_Cmd( TIM5, ENABLE);
-#endif
-        enqueueByDeadline(m, &msgQ);
-        if (wasEnabled && threadPool && (msgQ->deadline - activeStack->msg->deadline < 0)) {
-            push(pop(&threadPool), &activeStack);
-#ifdef	__TRACE_DISPATCH
-			DUMP("dispatch() in async()");
-			DUMP("\n\r");
-#endif
-            dispatch(activeStack);
-        }
-    }
-    
-    ENABLE(wasEnabled);
-    return m;
-}
-
-int sync(Object *to, Method meth, int arg) {
-    Thread t;
-    int result;
-    char wasEnabled = ENABLED();
-    
-    DISABLE();
-
-//	DUMP("Entered sync(): ");
-//	DUMP("\n\r"); 
-
-    t = to->ownedBy;
-    if (t) {                            // to is already locked
-        while (t->waitsFor) 
-            t = t->waitsFor->ownedBy;
-        if (t == current || !wasEnabled) {  // deadlock!
-            ENABLE(wasEnabled);
-            return -1;
-        }
-        if (to->wantedBy)               // must be a lower priority thread
-            to->wantedBy->waitsFor = NULL;
-        to->wantedBy = current;
-        current->waitsFor = to;
-#ifdef	__TRACE_DISPATCH
-		DUMP("dispatch() in sync() - already locked");
-		DUMP("\n\r");
-#endif
-        dispatch(t);
-        if (current->msg == NULL) {     // message was aborted (when called from run)
-            ENABLE(wasEnabled);
-            return 0;
-        }
-    }
-    to->ownedBy = current;
-    ENABLE(wasEnabled && (to->wantedBy != INSTALLED_TAG)); // don't enable interrupts if running as handler
-    result = meth(to, arg);
-    DISABLE();
-    to->ownedBy = NULL; 
-    t = to->wantedBy;
-    if (t && (t != INSTALLED_TAG)) {      // we have run on someone's behalf
-        to->wantedBy = NULL; 
-        t->waitsFor = NULL;
-#ifdef	__TRACE_DISPATCH
-		DUMP("dispatch() in sync() - run on someone's behalf");
-		DUMP("\n\r");
-#endif
-        dispatch(t);
-    }
-    ENABLE(wasEnabled);
-    return result;
-}
-
-void ABORT(Msg m) {
-    char wasEnabled = ENABLED();
-    DISABLE();
-
-    if (remove(m, &timerQ) || remove(m, &msgQ))
-        insert(m, &msgPool);
-    else {
-        Thread t = activeStack;
-        while (t) {
-            if ((t != current) && (t->msg == m) && (t->waitsFor == m->to)) {
-	            t->msg = NULL;
-	            insert(m, &msgPool);
-	            break;
-            }
-            t = t->next;
-        }
-    }
-    ENABLE(wasEnabled);
-}
-
-void T_RESET(Timer *t) {
-    t->accum = ENABLED() ? current->msg->baseline : timestamp;
-}
-
-Time T_SAMPLE(Timer *t) {
-    return (ENABLED() ? current->msg->baseline : timestamp) - t->accum;
-}
-
-Time CURRENT_OFFSET(void) {
-    Time now;
-    char wasEnabled = ENABLED();
-    DISABLE();
-    TIMERGET(now);
-    ENABLE(wasEnabled);
-	return now - (wasEnabled ? current->msg->baseline : timestamp);
-}
-
-/* initialization */
-static void initialize(void) {
-    int i;
-    
-    for (i=0; i<NMSGS-1; i++)
-        messages[i].next = &messages[i+1];
-    messages[NMSGS-1].next = NULL;
-    
-    for (i=0; i<NTHREADS-1; i++)
-        threads[i].next = &threads[i+1];
-    threads[NTHREADS-1].next = NULL;
-    
-    for (i=0; i<NTHREADS; i++) {
-		threads[i].thread_no = i;
-        SETCONTEXT( threads[i].context );
-        SETSTACK( &threads[i].context, &stacks[i] );
-        SETPC( &threads[i].context, run );
-        threads[i].waitsFor = NULL;
-    }
-
-    thread0.thread_no = -1;
-	thread0.next = NULL;
-    thread0.waitsFor = NULL;
-    thread0.msg = NULL;
-    
-    DUMP("\n\r");
-    DUMP("TinyTimber ");
-    DUMP(TINYTIMBER_VERSION);
-    DUMP("\n\r");
-    DUMP("\n\r");
- 	
-    TIMER_INIT();
-}
-
-void install(Object *obj, Method m, enum Vector i) {
-    if (i >= 0 && i < N_VECTORS) {
-        char wasEnabled = ENABLED();
-        DISABLE();
-		switch (i) {
-		  case IRQ_USART1:
-			*((void (**)(void) ) USART1_IRQ_VECTOR ) = vect_USART1;
-			break;
-		  
-		  case IRQ_CAN1:
-			*((void (**)(void) ) CAN1_IRQ_VECTOR ) = vect_CAN1;
-			break;
-
-		  case IRQ_EXTI9_5:
-			*((void (**)(void) ) EXTI9_5_IRQ_VECTOR ) = vect_EXTI9_5;
-			break;
-
-		  default:
-			PANIC("Device IRQ not supported ...");
-		}
-        otable[i] = obj;
-        mtable[i] = m;
-        obj->wantedBy = INSTALLED_TAG;  // Mark object as subject to synchronization by interrupt disabling
-        ENABLE(wasEnabled);
-    }
-}
-
-int tinytimber(Object *obj, Method meth, int arg) {
-    DISABLE();
-    initialize();
-    if (meth != NULL) {
-		TIMERGET(timestamp);
-		runAsHardware = 1;
-        ASYNC(obj, meth, arg);
-		runAsHardware = 0;
-#ifdef	__TRACE_SCHEDULE
-		DUMP("schedule() in tinytimber()");
-		DUMP("\n\r");
-#endif
-		schedule();
-	}
-    idle();
-    return 0;
-}
+// The Timber compiler <timber-lang.org>
+// 
+// Copyright 2008-2012 Johan Nordlander <nordland@csee.ltu.se>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 
+// 3. Neither the names of the copyright holder and any identified
+//    contributors, nor the names of their affiliations, may be used to 
+//    endorse or promote products derived from this software without 
+//    specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS ``AS IS'' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * 
+ * TinyTimber.c
+ *
+ */
+
+#include "TinyTimber.h"
+#include "stm32f4xx.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_usart.h"
+#include "stm32f4xx_tim.h"
+#include "stm32f4xx_rcc.h"
+
+void DUMPC(char);
+
+void DUMP(char *s) {
+  while (*s) {
+	if (*s != '\r')
+		DUMPC(*s++);
+	else
+		s++;
+  }
+}
+
+char hex[] = "0123456789ABCDEF";
+
+void DUMPH(unsigned int val) {
+    char buf[8];
+    int i = 0;
+    do {
+        buf[i++] = hex[val & 0x0F];
+        val = val >> 4;
+    } while (val);
+    while (i)
+        DUMPC(buf[--i]);
+}
+
+void DUMPD(int val) {
+    char buf[100];
+	
+	int sign = val < 0 ? -1 : 1;
+	
+	val = val * sign;
+		
+    int i = 0;
+    do {
+        buf[i++] = hex[val % 10];
+        val = val / 10;
+    } while (val);
+	if (sign < 0)
+		DUMPC('-');
+    while (i)
+        DUMPC(buf[--i]);
+
+}
+
+// TIM5 compare channels: one per timer class, then CBS and execution budgets
+#ifdef	__USE_CBS
+#define CBS_CHANNEL     __TIMER_CLASSES
+#define BUDGET_CHANNEL  (__TIMER_CLASSES + 1)
+#else
+#define BUDGET_CHANNEL  __TIMER_CLASSES
+#endif
+#ifdef	__USE_BUDGET
+#define TIMER_CHANNELS  (BUDGET_CHANNEL + 1)
+#else
+#define TIMER_CHANNELS  BUDGET_CHANNEL
+#endif
+#if TIMER_CHANNELS > 4
+#error "TIM5 has four compare channels"
+#endif
+
+#ifdef	__HOST
+
+#include "hostTinyTimber.h"
+
+#else
+
+// Cortex m4 dependencies
+
+#define __CURRENT_PRIORITY ((__get_BASEPRI() >> (8 - __NVIC_PRIO_BITS)))
+
+void sei( void)			{ __set_BASEPRI(__DISABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
+void cli( void)			{ __set_BASEPRI(__ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
+
+#define PROTECTED()		(__CURRENT_PRIORITY == __DISABLED_PRIORITY)	
+
+#define __CURRENT_EXCEPTION (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk)
+
+#define THREADMODE()	(__CURRENT_EXCEPTION == 0)
+
+#define SLEEP()         { __asm volatile ("     wfi\n"); }
+
+#define RED_ALERT()     { GPIO_WriteBit(GPIOB, GPIO_Pin_1, (BitAction) 0); }  // Red LED On
+
+#define PANIC(s)         { DUMP("PANIC!!! "); RED_ALERT(); DUMP(s); while (1) SLEEP(); }
+
+#ifdef __USE_LOCAL_SBRK
+//register char *__stack_ptr asm ("sp");
+
+char *__heap_end;
+
+void *_sbrk (int incr)
+{
+	extern char   end; /* Set by linker.  */
+	char *        prev_heap_end;
+
+	DUMP("NOTE: _sbrk in use!\n\r");
+
+	if (__heap_end == 0)
+     __heap_end = & end;
+
+	prev_heap_end = __heap_end;
+   
+//	if (__heap_end + incr > __stack_ptr) // will fail if stacks[0]-stacks[3] is used
+//		PANIC("_sbrk: Heap and stack collision\r\n");
+
+	__heap_end += incr;
+
+	return (void *) prev_heap_end;
+}
+#endif
+
+#endif
+
+#define ENABLED()      	(!PROTECTED())
+#define DISABLE()      	{ sei(); }
+#define ENABLE(s)	    { if (s) cli(); }
+
+#define NTHREADS        4
+
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_SPAN      (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#ifndef	__HOST
+
+#define CONTEXTSIZE		(8+10)
+
+#define CONTEXT_T uint32_t
+
+#define STACKSIZE       1024
+
+#define STACK_T long long
+
+struct stack;
+
+/*
+ * Context of a thread that has no floating point state (EXC_RETURN bit 4
+ * set), which is how every thread starts out:
+ * 
+ * xPSR,					(OFFSET = 17) 
+ * PC,						(OFFSET = 16)
+ * LR, 						(OFFSET = 15)
+ * R12,						(OFFSET = 14)
+ * R3-R0		(8 words)	(OFFSET = 10-13)
+ * R11-R4,					(OFFSET = 2-9)
+ * BASEPRI,					(OFFSET = 1)
+ * EXC_RETURN	(10 words)	(OFFSET = 0)
+ *
+ * Once a thread uses the FPU, the hardware frame is extended with S0-S15
+ * and FPSCR (18 words, lazily stacked) and dispatch.s saves S16-S31
+ * between R11 and R0.
+ */
+
+#define	CONTEXT_xPSR_OFF	17
+#define	CONTEXT_PC_OFF		16
+#define	CONTEXT_BASEPRI_OFF	1
+#define	CONTEXT_EXC_OFF		0
+
+#define HW32_REG(ADDRESS) (*((volatile unsigned long *)(ADDRESS)))
+ 
+#define SETCONTEXT(c)	
+
+void SETSTACK(CONTEXT_T *cp, struct stack *sp) {
+	*cp = ((CONTEXT_T) sp) + STACKSIZE*sizeof(STACK_T) - CONTEXTSIZE*sizeof(CONTEXT_T);
+	
+	CONTEXT_T ci = *cp;
+	int i;
+	for (i=0; i<CONTEXTSIZE;i++)
+		HW32_REG(ci + (i<<2)) = 0;
+	HW32_REG(ci + (CONTEXT_EXC_OFF<<2)) = 0xFFFFFFF9;   // thread mode, MSP, no FP state
+	HW32_REG(ci + (CONTEXT_BASEPRI_OFF<<2)) = __ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS);
+	HW32_REG(ci + (CONTEXT_xPSR_OFF<<2)) = 0x01000000;
+}
+
+void SETPC(CONTEXT_T *cp, void (*fp)(void)) {
+	CONTEXT_T pc_p = *cp + (CONTEXT_PC_OFF<<2);
+	HW32_REG(pc_p) = (unsigned long) fp;
+}
+
+#define	VECTOR_ADDR(offset)		(0x2001C000+(offset))   // vector table in RAM
+
+#define	PendSV_IRQ_VECTOR		VECTOR_ADDR(0x38)
+#define PendSV_Exception		void vect_PendSV( void ) 
+#define PENDSV_SET()            { SCB->ICSR = SCB_ICSR_PENDSVSET_Msk; }    // one store, no read-modify-write
+
+PendSV_Exception;
+void vect_PendSV_SRP( void);
+
+#define	SVCall_IRQ_VECTOR		VECTOR_ADDR(0x2C)
+#define SVCall_Exception		void vect_SVCall( void ) 
+
+SVCall_Exception;
+void vect_SVCall_SRP( void);
+
+#define	TIM5_IRQ_VECTOR			VECTOR_ADDR(0x108)
+#define TIMER_COMPARE_INTERRUPT void vect_TIM5( void ) 
+
+TIMER_COMPARE_INTERRUPT;
+
+#define	DEVICE_IRQ_VECTOR(n)	VECTOR_ADDR(0x40 + ((n) << 2))  // after the 16 system exceptions
+#define DEVICE_INTERRUPT		void vect_IRQ( void )
+#define ACTIVE_IRQ()			((int)(SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) - 16)
+
+DEVICE_INTERRUPT;
+
+#define TIMER_CCLR(c)   { TIM_ClearITPendingBit(TIM5, TIM_IT_CC1 << (c)); }  // Timer compare interrupt clear, channel c+1
+#define TIMER_OCLR()    { TIM_ClearITPendingBit(TIM5, TIM_IT_Update); }  // Timer overflow interrupt clear
+
+#define TIMER_COMPARED(c)   (TIM_GetITStatus(TIM5, TIM_IT_CC1 << (c)) != RESET)
+#define TIMER_OVERFLOWED()  (TIM_GetFlagStatus(TIM5, TIM_FLAG_Update) != RESET)
+
+void TIMER_INIT() {
+	TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;	
+
+/*
+	Default values:
+        (++) Autoreload value = 0xFFFFFFFF
+        (++) Prescaler value = 0x0000
+        (++) Counter mode = Up counting
+        (++) Clock Division = TIM_CKD_DIV1
+ */
+
+	TIM_DeInit(TIM5);
+	
+	TIM_TimeBaseStructInit(&TIM_TimeBaseInitStructure);
+	TIM_TimeBaseInitStructure.TIM_Prescaler = __TIMER_PRESCALE;
+	TIM_TimeBaseInit(TIM5, &TIM_TimeBaseInitStructure);
+
+#ifdef	__USE_SRP
+	*((void (**)(void) ) PendSV_IRQ_VECTOR ) = vect_PendSV_SRP;
+#else
+	*((void (**)(void) ) PendSV_IRQ_VECTOR ) = vect_PendSV;
+#endif
+
+	NVIC_SetPriority(PendSV_IRQn, __PENDSV_PRIORITY); // below every interrupt handler
+
+#ifdef	__USE_SRP
+	*((void (**)(void) ) SVCall_IRQ_VECTOR ) = vect_SVCall_SRP;
+#else
+	*((void (**)(void) ) SVCall_IRQ_VECTOR ) = vect_SVCall;
+#endif
+
+	NVIC_SetPriority(SVCall_IRQn, 0x00); // highest priority
+
+	*((void (**)(void) ) TIM5_IRQ_VECTOR ) = vect_TIM5;
+
+	NVIC_SetPriority( TIM5_IRQn, __TIMER_PRIORITY); 
+	NVIC_EnableIRQ( TIM5_IRQn);
+
+	TIM_SetCounter(TIM5, 0);	
+	TIMER_OCLR();   // set by the update event of TIM_TimeBaseInit
+	TIM_Cmd( TIM5, ENABLE);
+
+	TIM_ITConfig( TIM5, TIM_IT_Update, ENABLE);	// counts overflows for the 64-bit clock
+	// The compare channels are enabled when first armed (TIMER_ARM)
+}
+
+#define TIMERGET(x)		(x = TIM_GetCounter(TIM5))
+
+#define TIMERSET(c, t)	((&TIM5->CCR1)[c] = (t))     // compare register of channel c+1
+
+// Clearing the flag of a channel leaves it armed, to match again when the
+// counter comes round to the compare value. A channel that is no longer
+// wanted is disarmed, and armed again with a fresh flag.
+#define TIMER_ARM(c, t)     { TIM_ClearITPendingBit(TIM5, TIM_IT_CC1 << (c)); TIMERSET(c, t); \
+                              TIM_ITConfig(TIM5, TIM_IT_CC1 << (c), ENABLE); }
+#define TIMER_DISARM(c)     { TIM_ITConfig(TIM5, TIM_IT_CC1 << (c), DISABLE); \
+                              TIM_ClearITPendingBit(TIM5, TIM_IT_CC1 << (c)); }
+
+#define CYCLES()        (DWT->CYCCNT)
+#define CYCLES_PER_SEC  SystemCoreClock
+
+#endif
+
+#define INFINITY        0x7fffffffL
+
+// Relative deadline of messages sent without one. Deadlines are compared
+// through their difference, so this leaves half the range of Time for
+// messages that are overdue when compared with it.
+#define NO_DEADLINE     (INFINITY / 2)
+
+#ifndef	__HOST
+void DUMPC(char c) {
+   USART_SendData(USART1, c );
+   while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);    
+}
+#endif
+
+// End of target dependencies
+
+typedef struct thread_block *Thread;
+
+#define INSTALLED_TAG (Thread)1
+
+struct msg_block {
+    Msg next;                // for use in linked lists
+    Time baseline;           // event time reference point
+    Time deadline;           // absolute deadline (=priority)
+    Time relative;           // deadline relative to the baseline, as sent
+    Object *to;              // receiving object
+    Method method;           // code to run
+    int arg;                 // argument to the above
+    unsigned int seqno;      // arrival order, breaks deadline ties (FIFO)
+    int index;               // position in readyQ while ready
+    Msg prev;                // backward link in timer slots
+    Msg *slot;               // timer slot holding the message
+    Time period;             // re-arm interval of periodic messages, else 0
+    char queue;              // MSG_FREE, MSG_TIMED, MSG_READY or MSG_ACTIVE
+    char late;               // already counted as a deadline miss
+    char timer;              // timer class while timed
+    char hard;               // run by the timer interrupt (SEND_IRQ)
+    char held;               // counted as held back by a preemption threshold
+    char overrun;            // exceeded the budget of its receiver
+    char demoted;            // has no deadline since then
+    Time used;               // execution time so far (with __USE_BUDGET)
+    struct server *server;   // charged since its release (with __USE_CBS)
+    int payload[(__MSG_PAYLOAD + 3) / 4];   // data of SEND_DATA, arg points here
+};
+
+// Queue membership of a message, so that it can be unlinked in bounded time
+#define MSG_FREE        0
+#define MSG_TIMED       1
+#define MSG_READY       2
+#define MSG_ACTIVE      3
+
+// Preemption level of a message: its relative deadline (shorter is higher).
+#define LEVEL(m)        ((m)->deadline - (m)->baseline)
+
+// Options of post()
+#define POST_MAYFAIL    1       // return NULL when the pool is low
+#define POST_HARD       2       // a hardware task, see runHard()
+
+// Timed messages are split by relative deadline into timer classes, each
+// with its own timing wheel and TIM5 compare channel, so that frequent short
+// deadline releases are not held up by the slow ones.
+struct timer_queue {
+    Msg wheel[WHEEL_LEVELS][WHEEL_SIZE];    // timing wheel slots (tail pointers)
+    uint64_t map[WHEEL_LEVELS];             // occupied slots per level
+    Msg far;                                // beyond the reach of the wheel
+    Time time;                              // next tick to be examined
+    Time due;                               // value in the compare register
+    int armed;
+};
+
+struct thread_block {
+	CONTEXT_T context;     	 // machine state */
+	int thread_no;
+    Thread next;             // for use in linked lists
+    Msg msg;                 // message under execution
+    Object *waitsFor;        // deadlock detection link
+    uint32_t net;            // cycles executed by the thread (profiling)
+};
+
+struct stack {
+    STACK_T stack[STACKSIZE];
+};
+
+struct msg_block    messages[NMSGS];
+#ifndef	__USE_SRP
+struct thread_block threads[NTHREADS];
+struct stack        stacks[NTHREADS];
+#endif
+
+struct thread_block thread0;
+
+Msg msgPool         = messages;
+Msg readyQ[NMSGS];                  // binary min-heap ordered by (deadline, seqno)
+int readyCount      = 0;
+unsigned int readySeqno = 0;
+int poolInUse       = 0;
+int poolHighWater   = 0;
+int poolFailures    = 0;
+SchedStats sched    = { 0, 0, 0, 0, 0 };
+MissStats missTable[__MISS_ENTRIES];    // per method, last entry for the rest
+int missCount       = 0;
+void (*missHook)(Object*, Method, Time) = NULL;
+struct timer_queue timerQs[__TIMER_CLASSES];   // one per compare channel
+const Time timerLimits[] = __TIMER_CLASS_LIMITS;
+const Time irqLimits[] = __IRQ_LEVEL_LIMITS;
+const int poolReserves[] = __POOL_LEVEL_RESERVES;
+int handlerLevel    = __ENABLED_PRIORITY;   // NVIC level of the running handler
+int runAsHardware	= 0;
+int doIRQSchedule	= 0;
+Time timestamp      = 0;
+unsigned int overflows = 0;             // TIM5 wraps, upper half of the 64-bit clock
+
+#ifdef	__USE_SRP
+Time srpCeiling     = INFINITY;         // system ceiling: min ceiling of locked objects
+#else
+Thread threadPool   = threads;
+#endif
+Thread activeStack  = &thread0;
+Thread current      = &thread0;
+Thread upcoming;
+
+Method  mtable[N_VECTORS];
+Object *otable[N_VECTORS];
+char    ltable[N_VECTORS];              // NVIC level of each installed line
+
+Mailbox *mailboxes  = NULL;            // opened mailboxes
+volatile char mailPending = 0;          // posted since the last drain, or left for lack of messages
+
+#ifdef	__USE_CBS
+Server *cbsRunning  = NULL;             // charged for the time since cbsStamp
+Time cbsStamp       = 0;
+static void cbsCharge( Server*, Time);
+static void cbsArrive( Msg, Time);
+// m is released and gets the deadline of its server
+#define CBS_ARRIVE(m, now)  cbsArrive(m, now)
+// m is done with (completed or aborted after its release)
+#define CBS_DONE(m)         { if ((m)->server) { (m)->server->pending--; (m)->server = NULL; } }
+#else
+#define CBS_ARRIVE(m, now)
+#define CBS_DONE(m)
+#endif
+
+#ifdef	__USE_BUDGET
+Msg budgetRunning   = NULL;             // charged for the time since budgetStamp
+Time budgetStamp    = 0;
+int (*overrunHook)(Object*, Method, Time) = NULL;
+static void budgetCharge( Msg, Time);
+#endif
+
+#if defined(__USE_CBS) || defined(__USE_BUDGET)
+static void charge( Msg);
+// The message that runs from now on (NULL if none), the one that ran until
+// now is charged
+#define CHARGE(m)           charge(m)
+#else
+#define CHARGE(m)
+#endif
+
+static void completed( Msg);
+static int preempts( Msg, Msg);
+static void drain( void);
+static void missed( Msg, Time);
+
+#ifdef	__USE_PROFILE
+ProfileStats profTable[__PROFILE_ENTRIES];  // hashed on the method
+int profDropped     = 0;                // executions that found the table full
+uint32_t profStamp  = 0;                // cycles up to here are accounted for
+int profDepth       = 0;                // interrupt handlers active, nested
+uint32_t profNested = 0;                // cycles of handlers that have returned
+static void profile( Method, uint32_t);
+// Net cycles of the running thread up to now
+#define PROF_NET(now)       (current->net + (now) - profStamp)
+// Give the cycles since the last accounting to the running thread
+#define PROF_CHARGE(now)    { current->net += (now) - profStamp; profStamp = (now); }
+// Interrupt handlers are timed and then charged to no one. Only the
+// outermost one ends the time of the interrupted thread, and each is
+// charged its own time, less that of the handlers that preempted it.
+#define PROF_ENTER()        uint32_t irqStart = CYCLES(), irqNested = profNested; \
+                            if (profDepth++ == 0) PROF_CHARGE(irqStart)
+#define PROF_EXIT(m)        { uint32_t now = CYCLES(); \
+                              if (m) profile(m, now - irqStart - (profNested - irqNested)); \
+                              profNested = irqNested + (now - irqStart); \
+                              if (--profDepth == 0) profStamp = now; }
+#else
+#define PROF_ENTER()
+#define PROF_EXIT(m)
+#endif
+
+#ifdef	__USE_TRACE
+TraceEvent traceRing[__TRACE_EVENTS];
+uint32_t traceHead  = 0;                // events recorded
+uint32_t traceTail  = 0;                // events read by TRACE_READ
+static void traceEvent( int, uint32_t);
+#define TRACE(type, arg)    traceEvent(type, (uint32_t)(arg))
+#else
+#define TRACE(type, arg)
+#endif
+
+#ifdef	__SIM
+#define SIM_EXECUTED(meth)  simExecuted(meth)   // virtual execution time
+#else
+#define SIM_EXECUTED(meth)
+#endif
+#ifdef	__USE_SRP
+static void srpSchedule( void);
+#else
+// A thread is taken from the pool, for a message on top of top (NULL if idle)
+#define THREAD_TAKEN(top)   { if (top) sched.preemptions++; \
+                              if (++sched.depth > sched.maxDepth) sched.maxDepth = sched.depth; }
+static void dispatch( Thread);
+#endif
+static void schedule( void);
+static void rearm( Msg);
+static int runHard( Msg);
+static int release( Msg, Time);
+
+// Cortex m4 dependencies
+
+// Every installed device interrupt enters here and finds its method by
+// the number of the active vector. Handlers on different levels nest, so
+// the state of a preempted handler is kept and restored.
+DEVICE_INTERRUPT {
+        int n = ACTIVE_IRQ();
+        Time stamp = timestamp;
+        int wasHardware = runAsHardware, wasSchedule = doIRQSchedule, wasLevel = handlerLevel;
+        PROF_ENTER();
+        TRACE(TRACE_IRQ_ENTRY, n);
+        TIMERGET(timestamp); runAsHardware = 1; doIRQSchedule = 0; handlerLevel = ltable[n];
+        if (mtable[n]) { mtable[n](otable[n],n); SIM_EXECUTED(mtable[n]); }
+        if (doIRQSchedule) { DISABLE(); schedule(); ENABLE(1); }
+        timestamp = stamp; runAsHardware = wasHardware; doIRQSchedule = wasSchedule; handlerLevel = wasLevel;
+        TRACE(TRACE_IRQ_EXIT, n);
+        PROF_EXIT(mtable[n]);
+}
+
+// End of target dependencies
+
+/* queue manager */
+
+// The ready queue is a binary heap over msg_block pointers, so insertion and
+// removal of the earliest deadline cost O(log n) with interrupts disabled.
+// Equal deadlines are served in arrival order, as with the former sorted list.
+#define EARLIER(a,b)    ((a)->deadline - (b)->deadline < 0 || \
+                         ((a)->deadline == (b)->deadline && (int)((a)->seqno - (b)->seqno) < 0))
+
+static void heapPlace(Msg m, int i) {
+    readyQ[i] = m;
+    m->index = i;
+}
+
+static void heapUp(int i) {
+    Msg m = readyQ[i];
+    while (i > 0) {
+        int parent = (i - 1) >> 1;
+        if (!EARLIER(m, readyQ[parent]))
+            break;
+        heapPlace(readyQ[parent], i);
+        i = parent;
+    }
+    heapPlace(m, i);
+}
+
+static void heapDown(int i) {
+    Msg m = readyQ[i];
+    while (1) {
+        int child = (i << 1) + 1;
+        if (child >= readyCount)
+            break;
+        if (child + 1 < readyCount && EARLIER(readyQ[child + 1], readyQ[child]))
+            child++;
+        if (!EARLIER(readyQ[child], m))
+            break;
+        heapPlace(readyQ[child], i);
+        i = child;
+    }
+    heapPlace(m, i);
+}
+
+static void heapDelete(int i) {
+    Msg last = readyQ[--readyCount];
+    if (i == readyCount)
+        return;
+    heapPlace(last, i);
+    if (i > 0 && EARLIER(last, readyQ[(i - 1) >> 1]))
+        heapUp(i);
+    else
+        heapDown(i);
+}
+
+#define READYQ_HEAD()   (readyCount ? readyQ[0] : NULL)
+
+void enqueueByDeadline(Msg p) {
+    p->seqno = readySeqno++;
+    p->queue = MSG_READY;
+    readyQ[readyCount] = p;
+    heapUp(readyCount++);
+}
+
+Msg dequeueByDeadline(void) {
+    Msg m;
+    if (readyCount == 0)
+        PANIC("Empty queue");  // Empty queue, kernel panic!!!
+    m = readyQ[0];
+    heapDelete(0);
+    m->queue = MSG_ACTIVE;
+    return m;
+}
+
+static void removeByDeadline(Msg m) {
+    heapDelete(m->index);
+}
+
+// Pending timed messages live in a hierarchical timing wheel keyed on the
+// TIM5 tick. Level L has WHEEL_SIZE slots, each covering 2^(L*WHEEL_BITS)
+// ticks; messages further away than the last level wait in far. A level
+// 0 slot only ever holds messages with one and the same baseline, so expiry
+// unhooks the whole slot at once. Each slot is a doubly linked circular list
+// reached through its tail, which gives O(1) append and unlink while keeping
+// posting order.
+#define SLOT_OF(t,l)    ((int)(((uint32_t)(t) >> ((l) * WHEEL_BITS)) & WHEEL_MASK))
+
+static void slotAppend(Msg m, Msg *slot) {
+    Msg tail = *slot;
+    if (tail) {
+        m->next = tail->next;
+        m->prev = tail;
+        tail->next->prev = m;
+        tail->next = m;
+    } else
+        m->next = m->prev = m;
+    *slot = m;
+    m->slot = slot;
+    m->queue = MSG_TIMED;
+}
+
+static void slotRemove(Msg m) {
+    Msg *slot = m->slot;
+    if (m->next == m)
+        *slot = NULL;
+    else {
+        m->prev->next = m->next;
+        m->next->prev = m->prev;
+        if (*slot == m)
+            *slot = m->prev;
+    }
+}
+
+// Turn a circular slot list into a NULL-terminated one, oldest first.
+static Msg slotTake(Msg *slot) {
+    Msg tail = *slot, head = NULL;
+    if (tail) {
+        head = tail->next;
+        tail->next = NULL;
+        *slot = NULL;
+    }
+    return head;
+}
+
+static int ctz64(uint64_t x) {
+    return __builtin_ctzll(x);
+}
+
+// Timer class of m: the first whose limit its relative deadline is within.
+static int timerClass(Msg m) {
+    Time rel = m->relative;             // not a server deadline (see cbsArrive)
+    int c;
+    if (m->hard)
+        return 0;                       // the most precise release
+    for (c = 0; c < __TIMER_CLASSES - 1; c++)
+        if (rel <= timerLimits[c])
+            break;
+    return c;
+}
+
+void enqueueByBaseline(struct timer_queue *q, Msg p) {
+    uint32_t delta = (uint32_t)(p->baseline - q->time);
+    int level;
+    if ((int32_t)delta < 0)
+        delta = 0;
+    if (delta >= WHEEL_SPAN) {
+        slotAppend(p, &q->far);
+        return;
+    }
+    for (level = 0; delta >= (1UL << ((level + 1) * WHEEL_BITS)); level++)
+        ;
+    slotAppend(p, &q->wheel[level][SLOT_OF(p->baseline, level)]);
+    q->map[level] |= 1ULL << SLOT_OF(p->baseline, level);
+}
+
+static void removeByBaseline(Msg m) {
+    struct timer_queue *q = &timerQs[(int)m->timer];
+    Msg *slot = m->slot;
+    slotRemove(m);
+    if (!*slot && slot != &q->far) {
+        int n = slot - &q->wheel[0][0];
+        q->map[n / WHEEL_SIZE] &= ~(1ULL << (n % WHEEL_SIZE));
+    }
+}
+
+// Earliest tick at which the wheel needs attention: an exact baseline for
+// level 0, the start of the next occupied slot for the higher levels.
+static int wheelNext(struct timer_queue *q, Time *next) {
+    int level, found = 0;
+    Time t, best = 0;
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t map = q->map[level];
+        int shift = level * WHEEL_BITS;
+        int cur = SLOT_OF(q->time, level);
+        int k;
+        if (!map)
+            continue;
+        if (cur)
+            map = (map >> cur) | (map << (WHEEL_SIZE - cur));
+        if (((uint32_t)q->time & ((1UL << shift) - 1)) == 0)
+            k = ctz64(map);             // current slot not yet passed
+        else                            // current slot is a full turn ahead
+            k = (map >> 1) ? ctz64(map >> 1) + 1 : WHEEL_SIZE;
+        t = (Time)(((uint32_t)q->time >> shift << shift) + ((uint32_t)k << shift));
+        if (!found || t - best < 0)
+            best = t;
+        found = 1;
+    }
+    if (q->far) {
+        t = (Time)(((uint32_t)q->time & ~(WHEEL_SPAN - 1)) + WHEEL_SPAN);
+        if (!found || t - best < 0)
+            best = t;
+        found = 1;
+    }
+    *next = best;
+    return found;
+}
+
+// Refile the higher level slots (and far) that begin at q->time.
+static void wheelCascade(struct timer_queue *q) {
+    int level;
+    Msg m, list;
+    if (((uint32_t)q->time & (WHEEL_SPAN - 1)) == 0) {
+        list = slotTake(&q->far);
+        while ((m = list)) {
+            list = m->next;
+            enqueueByBaseline(q, m);
+        }
+    }
+    for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+        int i;
+        if ((uint32_t)q->time & ((1UL << (level * WHEEL_BITS)) - 1))
+            continue;
+        i = SLOT_OF(q->time, level);
+        list = slotTake(&q->wheel[level][i]);
+        q->map[level] &= ~(1ULL << i);
+        while ((m = list)) {
+            list = m->next;
+            enqueueByBaseline(q, m);
+        }
+    }
+}
+
+// Move every message with a baseline at or before now to the ready queue,
+// or to the list ending at *hard if it is a hardware task.
+static void wheelRelease(struct timer_queue *q, Time now, Msg **hard) {
+    Time t;
+    while (wheelNext(q, &t) && (t - now <= 0)) {
+        int i = SLOT_OF(t, 0);
+        Msg m, list;
+        q->time = t;
+        wheelCascade(q);
+        list = slotTake(&q->wheel[0][i]);
+        q->map[0] &= ~(1ULL << i);
+        while ((m = list)) {
+            list = m->next;
+            TRACE(TRACE_RELEASE, m);
+            if (m->hard) {
+                m->next = NULL;         // run by the caller, in release order
+                **hard = m;
+                *hard = &m->next;
+            } else {
+                CBS_ARRIVE(m, now);
+                enqueueByDeadline(m);
+            }
+        }
+        q->time = t + 1;
+    }
+}
+
+static int wheelEmpty(struct timer_queue *q) {
+    int level;
+    for (level = 0; level < WHEEL_LEVELS; level++)
+        if (q->map[level])
+            return 0;
+    return q->far == NULL;
+}
+
+// Take a message from the pool unless that would leave keep or fewer behind.
+// Pool messages that the running code may not take: none for methods,
+// fewer for more urgent interrupt levels. The timer interrupt (hardware
+// tasks) counts as the most urgent level.
+static int poolReserve(void) {
+    int l = handlerLevel - (__TIMER_PRIORITY + 1);
+    if (!runAsHardware)
+        return 0;
+    if (l < 0)
+        l = 0;
+    return l < sizeof(poolReserves) / sizeof(int) ? poolReserves[l] : __POOL_RESERVE;
+}
+
+Msg dequeue_pool(Msg *queue, int keep) {
+    Msg m = *queue;
+    if (m && (NMSGS - poolInUse > keep)) {
+        *queue = m->next;
+        if (++poolInUse > poolHighWater)
+            poolHighWater = poolInUse;
+        return m;
+    }
+    return NULL;
+}
+
+void insert(Msg m, Msg *queue) {
+    if (queue == &msgPool)
+        poolInUse--;
+    m->queue = MSG_FREE;
+    m->next = *queue;
+    *queue = m;
+}
+
+void push(Thread t, Thread *stack) {
+    t->next = *stack;
+    *stack = t;
+}
+
+Thread pop(Thread *stack) {
+    Thread t = *stack;
+    *stack = t->next;
+    return t;
+}
+
+TIMER_COMPARE_INTERRUPT {
+    Time now;
+    int c, compared = 0, wasLevel = handlerLevel;
+ 
+    if (TIMER_OVERFLOWED()) {
+        TIMER_OCLR();
+        overflows++;
+    }
+    for (c = 0; c < TIMER_CHANNELS; c++)
+        if (TIMER_COMPARED(c))
+            compared |= 1 << c;
+    if (!compared)
+        return;
+    PROF_ENTER();
+#ifdef	__USE_SAFE_TIMER
+	TIM_Cmd( TIM5, DISABLE);
+#endif
+    TIMERGET(now);
+    TRACE(TRACE_IRQ_ENTRY, TIM5_IRQn);
+    handlerLevel = __TIMER_PRIORITY;    // for the hardware tasks
+
+    for (c = 0; c < __TIMER_CLASSES; c++) {   // only the classes that are due
+        struct timer_queue *q = &timerQs[c];
+        Msg m, hard = NULL, *tail = &hard;
+        if (!(compared & (1 << c)))
+            continue;
+        TIMER_CCLR(c);
+        wheelRelease(q, now, &tail);
+        while ((m = hard)) {
+            hard = m->next;
+            if (!runHard(m)) {          // receiver held, an ordinary message
+                CBS_ARRIVE(m, now);
+                enqueueByDeadline(m);
+            }
+        }
+        q->armed = wheelNext(q, &q->due);
+        if (q->armed) {
+#ifdef	__USE_FUTURE_CHECK_TIMER
+            Time timcount;
+            TIMERGET(timcount);
+            if (q->due - timcount < 0)
+                RED_ALERT();    // Next event is in the past!
+#endif
+            TIMERSET(c, q->due);
+        } else
+            TIMER_DISARM(c);
+	}
+#ifdef	__USE_CBS
+    if (compared & (1 << CBS_CHANNEL)) {
+        TIMER_CCLR(CBS_CHANNEL);
+        TIMERGET(now);
+        cbsCharge(cbsRunning, now);     // budget exhausted, or a late check
+    }
+#endif
+#ifdef	__USE_BUDGET
+    if (compared & (1 << BUDGET_CHANNEL)) {
+        TIMER_CCLR(BUDGET_CHANNEL);
+        TIMERGET(now);
+        budgetCharge(budgetRunning, now);   // overrun, or a late check
+    }
+#endif
+#ifdef	__USE_SAFE_TIMER
+	TIM_Cmd( TIM5, ENABLE);
+#endif
+    handlerLevel = wasLevel;
+    schedule();
+    TRACE(TRACE_IRQ_EXIT, TIM5_IRQn);
+    PROF_EXIT(NULL);
+}
+
+#ifdef	__USE_SRP
+
+/* single stack execution */
+
+// Stack Resource Policy: m may start on top of the running message if it
+// has an earlier deadline, a level above the system ceiling, and its
+// receiver is free. It then runs to completion without ever blocking.
+static int srpPreempts(Msg m) {
+    return preempts(m, current->msg)
+        && (LEVEL(m) < srpCeiling)
+        && !m->to->ownedBy;
+}
+
+// Run every ready message that may preempt the running one, nested on the
+// current stack. Called and returns with interrupts disabled.
+static void srpSchedule(void) {
+    Msg prev = current->msg;
+    while (readyCount && srpPreempts(readyQ[0])) {
+        Msg this = current->msg = dequeueByDeadline();
+        this->next = prev;              // the messages it preempts, see cbsReplenish
+        if (prev)
+            sched.preemptions++;
+        if (++sched.depth > sched.maxDepth)
+            sched.maxDepth = sched.depth;
+#ifdef	__USE_PROFILE
+        uint32_t start = PROF_NET(CYCLES());
+#endif
+        CHARGE(this);
+        TRACE(TRACE_RUN_START, this->method);
+        ENABLE(1);
+        SYNC(this->to, this->method, this->arg);
+        TRACE(TRACE_RUN_END, this->method);
+        completed(this);
+        DISABLE();
+#ifdef	__USE_PROFILE
+        current->net -= PROF_NET(CYCLES()) - start; // not part of the preempted method
+#endif
+        CBS_DONE(this);
+        CHARGE(prev);
+        sched.depth--;
+        if (this->period)
+            rearm(this);
+        else
+            insert(this, &msgPool);
+        if (mailPending)                // left in a mailbox while the pool was low
+            drain();
+        current->msg = prev;
+    }
+}
+
+// Entered in thread mode from vect_PendSV_SRP, on top of the interrupted
+// context, which is resumed through vect_SVCall_SRP when this returns.
+// Mail posted by interrupt handlers is turned into messages here.
+void srp_run(void) {
+    DISABLE();
+    if (mailPending)
+        drain();
+    srpSchedule();
+    ENABLE(1);
+}
+
+
+#else
+
+/* context switching */
+
+#ifdef	__HOST
+
+// There are no exception frames to build on the host: PendSV and SVCall
+// just swap contexts (see hostTinyTimber.c).
+void vect_SVCall( void) {
+    Thread prev = current;
+    current = upcoming;
+    if (prev != current)                // PendSV pended for mail only
+        hostSwitch(&prev->context, &current->context);
+}
+
+void vect_PendSV( void) {
+    pendsv_mail();
+    vect_SVCall();
+}
+
+#else
+__attribute__((naked)) 
+void __svc_dispatch( Thread next ) {
+	upcoming = next;
+	asm volatile(
+		"svc 0x10\n"
+		"mov pc, lr\n"
+	);
+}
+
+__attribute__((naked)) 
+void __pendSV_dispatch( Thread next ) {
+	upcoming = next;
+	SCB->ICSR |= (1<<28); // SCB_ICSR_PENDSVSET_Msk
+	asm volatile(
+		"mov pc, lr\n"
+	);
+}
+#endif
+
+void dispatch( Thread next ) {
+    TRACE(TRACE_DISPATCH, next->thread_no);
+	
+	if (THREADMODE()) {
+#ifdef	__USE_PROFILE
+		PROF_CHARGE(CYCLES());  // an interrupt handler is charged on its exit
+#endif
+		__svc_dispatch( next);	
+	}
+	else {
+		__pendSV_dispatch( next);
+	}
+
+	ENABLE(1);
+}
+
+static void run(void) {
+    while (1) {
+        Msg this = current->msg = dequeueByDeadline(); // Get first pending message
+        Msg oldMsg;
+        
+        CHARGE(this);
+        TRACE(TRACE_RUN_START, this->method);
+        ENABLE(1);
+        SYNC(this->to, this->method, this->arg);
+        TRACE(TRACE_RUN_END, this->method);
+        if (current->msg)                   // not aborted while blocked
+            completed(this);
+        DISABLE();
+
+#ifndef	__HOST
+        __set_CONTROL(__get_CONTROL() & ~0x04); // FP state of the finished method is dead (clear FPCA)
+        __ISB();
+#endif
+
+        CBS_DONE(this);
+        CHARGE(NULL);
+        if (this->period && current->msg)   // periodic and not aborted
+            rearm(this);
+        else
+            insert(this, &msgPool);
+        if (mailPending)                // left in a mailbox while the pool was low
+            drain();
+       
+        oldMsg = activeStack->next->msg;
+        if (!readyCount || (oldMsg && !preempts(readyQ[0], oldMsg))) {
+            Thread t;
+            push(pop(&activeStack), &threadPool);
+            sched.depth--;
+            t = activeStack;  // can't be NULL, may be &thread0
+            while (t->waitsFor) 
+	            t = t->waitsFor->ownedBy;
+            CHARGE(t->msg);
+            dispatch(t);
+        }
+	}
+}
+
+#endif
+
+static void idle(void) {
+    schedule();
+    while (1) {
+		ENABLE(1);
+		SLEEP();
+    }
+}
+
+#ifdef	__USE_SRP
+
+// From thread mode the preempting messages are simply called; an interrupt
+// handler leaves that to PendSV, which runs after the handler has returned.
+static void schedule(void) {
+    if (readyCount && srpPreempts(readyQ[0])) {
+        if (THREADMODE())
+            srpSchedule();
+        else
+            SCB->ICSR |= (1<<28); // SCB_ICSR_PENDSVSET_Msk
+    }
+}
+
+#else
+
+static void schedule(void) {
+    Msg topMsg = activeStack->msg;
+ 
+    if (readyCount && threadPool && preempts(readyQ[0], topMsg)) {
+        CHARGE(readyQ[0]);
+        push(pop(&threadPool), &activeStack);
+        THREAD_TAKEN(topMsg);
+
+        dispatch(activeStack);
+    }
+}
+
+#endif
+
+/* communication primitives */
+
+// Whether ready message n may start on top of running message m (NULL if
+// none): it must have an earlier deadline and, if the receiver of m has a
+// preemption threshold, a shorter relative deadline than that.
+static int preempts(Msg n, Msg m) {
+    if (!m)
+        return 1;
+    if (n->deadline - m->deadline >= 0)
+        return 0;
+    if (m->to->threshold && !m->demoted && LEVEL(n) >= m->to->threshold) {
+        if (!n->held) {
+            n->held = 1;
+            sched.avoided++;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// Run hardware task m at once, within the timer interrupt or critical
+// section that releases it, on behalf of no thread. The receiver is held
+// while m runs, as by sync(), so that the task is not entered again and a
+// SYNC on it from m fails. A periodic task is run again for every period
+// that has passed meanwhile and then goes back to the timing wheel.
+// Returns 0, leaving m to the caller, if a method holds the receiver.
+static int runHard(Msg m) {
+    Time now, late, stamp = timestamp;
+    int wasHardware = runAsHardware, wasLevel = handlerLevel;
+    Object *to = m->to;
+    if (to->ownedBy)
+        return 0;
+    to->ownedBy = current;
+    runAsHardware = 1;
+    handlerLevel = __TIMER_PRIORITY;    // its pool reserve, also from the late path
+    m->queue = MSG_ACTIVE;
+    while (1) {
+        timestamp = m->baseline;
+        TRACE(TRACE_RUN_START, m->method);
+        m->method(to, m->arg);
+        SIM_EXECUTED(m->method);
+        TRACE(TRACE_RUN_END, m->method);
+        TIMERGET(now);
+        late = now - m->deadline;
+        if (late > 0) {
+            missed(m, late);
+            if (missHook)
+                missHook(m->to, m->method, late);
+        }
+        if (!m->period) {               // done, or aborted by its method
+            insert(m, &msgPool);
+            break;
+        }
+        m->baseline += m->period;
+        m->deadline += m->period;
+        m->late = 0;
+        if (m->baseline - now > 0) {
+            release(m, now);
+            break;
+        }
+    }
+    to->ownedBy = NULL;
+    timestamp = stamp;
+    runAsHardware = wasHardware;
+    handlerLevel = wasLevel;
+    return 1;
+}
+
+// Put m in the timing wheel, or in the ready queue if its baseline has
+// already passed. Returns 1 in the latter case.
+static int release(Msg m, Time now) {
+    if (m->hard && m->baseline - now <= 0 && runHard(m))
+        return 0;                       // late already, and run
+    if (m->baseline - now > 0) {        // baseline has not yet passed
+        int c = timerClass(m);
+        struct timer_queue *q = &timerQs[c];
+        if (wheelEmpty(q))
+            q->time = now;
+        m->timer = c;
+        enqueueByBaseline(q, m);
+        if (!q->armed || (m->baseline - q->due < 0)) {
+            q->due = m->baseline;
+#ifdef	__USE_FUTURE_CHECK_TIMER
+			if (q->due - now < 0)
+				RED_ALERT();    // Next event is in the past!
+#endif
+            if (q->armed)
+                TIMERSET(c, q->due);
+            else {
+                q->armed = 1;
+                TIMER_ARM(c, q->due);
+            }
+        }
+        return 0;
+    }
+    TRACE(TRACE_RELEASE, m);
+    CBS_ARRIVE(m, now);
+    enqueueByDeadline(m);               // m is immediately schedulable
+    return 1;
+}
+
+// Switch to a new thread if the head of the ready queue should preempt the
+// running message.
+static void preempt(void) {
+#ifdef	__USE_SRP
+    schedule();
+#else
+    Msg topMsg = activeStack->msg;      // NULL when idle
+
+    if (threadPool && preempts(readyQ[0], topMsg)) {
+        CHARGE(readyQ[0]);
+        push(pop(&threadPool), &activeStack);
+        THREAD_TAKEN(topMsg);
+        dispatch(activeStack);
+    }
+#endif
+}
+
+// Advance periodic message m to its next release, with the relative
+// deadline it was sent with: its current deadline may have been changed
+// by a demotion.
+static void rearm(Msg m) {
+    Time now;
+    m->baseline += m->period;           // drift-free: relative to the last release
+    m->late = 0;
+    m->held = 0;
+    m->overrun = m->demoted = 0;
+    m->used = 0;
+    m->deadline = m->baseline + m->relative;
+    TIMERGET(now);
+    release(m, now);
+}
+
+static Msg post(Time bl, Time dl, Object *to, Method meth, int arg, const void *data, int size, Time period, int flags) {
+    Msg m;
+    Time now;
+    int ready;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    m = dequeue_pool(&msgPool, (flags & POST_MAYFAIL) ? poolReserve() : 0); // Get new message template
+    if (!m) {
+        if (!(flags & POST_MAYFAIL))
+            PANIC("Empty pool");  // Empty pool, kernel panic!!!
+        poolFailures++;
+        ENABLE(wasEnabled);
+        return NULL;
+    }
+    m->to = to; 
+    m->method = meth; 
+    if (data) {                         // copied before m can possibly run
+        const char *src = data;
+        char *dst = (char*) m->payload;
+        while (size-- > 0)
+            *dst++ = *src++;
+        arg = (int) m->payload;
+    }
+    m->arg = arg;
+    m->period = period;
+    m->late = 0;
+    m->held = 0;
+    m->overrun = m->demoted = 0;
+    m->used = 0;
+    m->server = NULL;
+    m->hard = (flags & POST_HARD) != 0;
+	m->baseline = (runAsHardware ? timestamp : current->msg->baseline) + bl;
+    m->relative = dl > 0 ? dl : NO_DEADLINE;
+    m->deadline = m->baseline + m->relative;
+#ifdef	__USE_SRP
+    ceiling(to, LEVEL(m));              // before m can possibly run
+#endif
+    
+#ifdef	__USE_SAFE_TIMER
+	TIM_Cmd( TIM5, DISABLE);
+#endif
+    TIMERGET(now);
+
+/*	DUMP("Entered async(): ");
+	DUMP("bl = ");
+	DUMPD(m->baseline);
+	DUMP(", dl = ");
+	DUMPD(m->deadline);
+	DUMP(", now = ");
+	DUMPD(now);
+	DUMP(", wasEnabled = ");
+	DUMPD(wasEnabled);
+	DUMP(", runAsHardware = ");
+	DUMPD(runAsHardware);
+	DUMP("\n\r"); */
+
+    ready = release(m, now);
+#ifdef	__USE_SAFE_TIMER
+	TIM_Cmd( TIM5, ENABLE);
+#endif
+    if (ready && wasEnabled)
+        preempt();
+    
+    ENABLE(wasEnabled);
+    return m;
+}
+
+Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
+    return post(bl, dl, to, meth, arg, NULL, 0, 0, 0);
+}
+
+Msg try_async(Time bl, Time dl, Object *to, Method meth, int arg) {
+    return post(bl, dl, to, meth, arg, NULL, 0, 0, POST_MAYFAIL);
+}
+
+Msg async_data(Time bl, Time dl, Object *to, Method meth, const void *data, int size, int mayFail) {
+    if (size > __MSG_PAYLOAD)
+        PANIC("Payload too large");
+    return post(bl, dl, to, meth, 0, data, size, 0, mayFail ? POST_MAYFAIL : 0);
+}
+
+Msg periodic(Time period, Time dl, Object *to, Method meth, int arg) {
+    if (period <= 0)
+        PANIC("Bad period");
+    return post(period, dl, to, meth, arg, NULL, 0, period, 0);
+}
+
+Msg hard_async(Time bl, Time dl, Time period, Object *to, Method meth, int arg) {
+    if (period < 0)
+        PANIC("Bad period");
+    return post(bl, dl, to, meth, arg, NULL, 0, period, POST_HARD);
+}
+
+void batch_send(Batch *b, Time bl, Time dl, Object *to, Method meth, int arg) {
+    if (b->count == __BATCH_SIZE)
+        PANIC("Batch full");
+    b->msg[b->count].bl = bl;
+    b->msg[b->count].dl = dl;
+    b->msg[b->count].to = to;
+    b->msg[b->count].meth = meth;
+    b->msg[b->count].arg = arg;
+    b->count++;
+}
+
+// Every post() finds interrupts disabled, so none of them makes a
+// scheduling decision of its own; the pool is checked first so that
+// none of them can fail.
+int batch_submit(Batch *b) {
+    int i, n = b->count;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    b->count = 0;
+    if (NMSGS - poolInUse - poolReserve() < n) {
+        poolFailures += n;
+        ENABLE(wasEnabled);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        post(b->msg[i].bl, b->msg[i].dl, b->msg[i].to, b->msg[i].meth, b->msg[i].arg, NULL, 0, 0, POST_MAYFAIL);
+    if (readyCount && wasEnabled)
+        preempt();
+    ENABLE(wasEnabled);
+    return 0;
+}
+
+void SET_PERIOD(Msg m, Time period) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    if (m->period > 0 && period > 0) {
+        if (m->queue == MSG_TIMED) {    // move the pending release
+            Time now, shift = period - m->period;
+            removeByBaseline(m);
+            m->baseline += shift;
+            m->deadline += shift;
+            TIMERGET(now);
+            if (release(m, now) && wasEnabled)
+                preempt();
+        }
+        m->period = period;
+    }
+    ENABLE(wasEnabled);
+}
+
+#ifdef	__USE_SRP
+
+// Without threads there is nothing to block: a locked receiver means that
+// the ceiling of to was too low when the method that holds it was
+// preempted, which is reported like a deadlock. While to is locked, the
+// system ceiling includes the ceiling of to.
+int sync(Object *to, Method meth, int arg) {
+    int result;
+    Time saved;
+#ifdef	__USE_PROFILE
+    uint32_t start;
+#endif
+    char wasEnabled = ENABLED();
+
+    DISABLE();
+    if (!runAsHardware && current->msg) // learn for next time
+        ceiling(to, LEVEL(current->msg));
+    if (to->ownedBy) {
+        TRACE(TRACE_SYNC_BLOCK, to);
+        ENABLE(wasEnabled);
+        return -1;
+    }
+    saved = srpCeiling;
+    if (to->ceiling && to->ceiling < srpCeiling)
+        srpCeiling = to->ceiling;
+    to->ownedBy = current;
+#ifdef	__USE_PROFILE
+    start = PROF_NET(CYCLES());
+#endif
+    ENABLE(wasEnabled && (to->wantedBy != INSTALLED_TAG)); // don't enable interrupts if running as handler
+    result = meth(to, arg);
+    DISABLE();
+#ifdef	__USE_PROFILE
+    profile(meth, PROF_NET(CYCLES()) - start);
+#endif
+    to->ownedBy = NULL;
+    srpCeiling = saved;
+    if (wasEnabled && readyCount)       // messages held back by the ceiling
+        schedule();
+    ENABLE(wasEnabled);
+    return result;
+}
+
+void ceiling(Object *obj, Time dl) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    if (dl > 0 && (!obj->ceiling || dl < obj->ceiling))
+        obj->ceiling = dl;
+    ENABLE(wasEnabled);
+}
+
+#else
+
+int sync(Object *to, Method meth, int arg) {
+    Thread t;
+    int result;
+#ifdef	__USE_PROFILE
+    uint32_t start;
+#endif
+    char wasEnabled = ENABLED();
+    
+    DISABLE();
+
+//	DUMP("Entered sync(): ");
+//	DUMP("\n\r"); 
+
+    t = to->ownedBy;
+    if (t) {                            // to is already locked
+        while (t->waitsFor) 
+            t = t->waitsFor->ownedBy;
+        if (t == current || !wasEnabled) {  // deadlock!
+            ENABLE(wasEnabled);
+            return -1;
+        }
+        if (to->wantedBy)               // must be a lower priority thread
+            to->wantedBy->waitsFor = NULL;
+        to->wantedBy = current;
+        current->waitsFor = to;
+        TRACE(TRACE_SYNC_BLOCK, to);
+        CHARGE(t->msg);
+        dispatch(t);
+        if (current->msg == NULL) {     // message was aborted (when called from run)
+            ENABLE(wasEnabled);
+            return 0;
+        }
+    }
+    to->ownedBy = current;
+#ifdef	__USE_PROFILE
+    start = PROF_NET(CYCLES());
+#endif
+    ENABLE(wasEnabled && (to->wantedBy != INSTALLED_TAG)); // don't enable interrupts if running as handler
+    result = meth(to, arg);
+    SIM_EXECUTED(meth);
+    DISABLE();
+#ifdef	__USE_PROFILE
+    profile(meth, PROF_NET(CYCLES()) - start);
+#endif
+    to->ownedBy = NULL; 
+    t = to->wantedBy;
+    if (t && (t != INSTALLED_TAG)) {      // we have run on someone's behalf
+        Time now;
+        TIMERGET(now);
+        if (t->msg && (now - t->msg->deadline > 0)) // it is late already
+            missed(t->msg, now - t->msg->deadline);
+        to->wantedBy = NULL; 
+        t->waitsFor = NULL;
+        CHARGE(t->msg);
+        dispatch(t);
+    }
+    ENABLE(wasEnabled);
+    return result;
+}
+
+#endif
+
+void ABORT(Msg m) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    TRACE(TRACE_ABORT, m);
+
+    switch (m->queue) {
+      case MSG_TIMED:
+        removeByBaseline(m);
+        insert(m, &msgPool);
+        break;
+
+      case MSG_READY:
+        removeByDeadline(m);
+        CBS_DONE(m);
+        insert(m, &msgPool);
+        break;
+
+      case MSG_ACTIVE: {              // may still be blocked in its first sync()
+        Thread t = activeStack;       // at most NTHREADS deep
+        m->period = 0;                // no further periodic releases
+#ifdef	__USE_SRP
+        t = NULL;                     // never blocked on a single stack
+#endif
+        while (t) {
+            if ((t != current) && (t->msg == m) && (t->waitsFor == m->to)) {
+	            t->msg = NULL;          // run() returns m to the pool
+	            break;
+            }
+            t = t->next;
+        }
+        break;
+      }
+    }
+    ENABLE(wasEnabled);
+}
+
+void T_RESET(Timer *t) {
+    t->accum = ENABLED() ? current->msg->baseline : timestamp;
+}
+
+Time T_SAMPLE(Timer *t) {
+    return (ENABLED() ? current->msg->baseline : timestamp) - t->accum;
+}
+
+void SCHED_STATS(SchedStats *s) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    *s = sched;
+    ENABLE(wasEnabled);
+}
+
+void threshold(Object *obj, Time dl) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    obj->threshold = dl > 0 ? dl : 0;
+    ENABLE(wasEnabled);
+}
+
+void POOL_STATS(PoolStats *s) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    s->size = NMSGS;
+    s->inUse = poolInUse;
+    s->highWater = poolHighWater;
+    s->failures = poolFailures;
+    ENABLE(wasEnabled);
+}
+
+/* kernel trace */
+
+#ifdef	__USE_TRACE
+
+// Claim a slot with an atomic increment of traceHead, so that interrupt
+// handlers can record events in the middle of a thread's recording. The
+// slot's seq is zero while it is being filled.
+static void traceEvent(int type, uint32_t arg) {
+    uint32_t i;
+    TraceEvent *e;
+    i = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED);
+    e = &traceRing[i & (__TRACE_EVENTS - 1)];
+    e->seq = 0;
+    __DMB();
+    e->cycles = CYCLES();
+    e->type = type;
+    e->thread = current->thread_no;
+    e->arg = arg;
+    __DMB();
+    e->seq = i + 1;
+}
+
+int TRACE_READ(TraceEvent *e, int n) {
+    int k = 0;
+    while (k < n && traceTail != traceHead) {
+        TraceEvent *r = &traceRing[traceTail & (__TRACE_EVENTS - 1)];
+        uint32_t seq = r->seq;
+        if (seq - (traceTail + 1) > 0x7fffffffUL)   // not yet written
+            break;
+        if (seq != traceTail + 1) {     // overwritten, skip to the oldest left
+            traceTail = traceHead - __TRACE_EVENTS;
+            continue;
+        }
+        __DMB();
+        e[k] = *r;
+        __DMB();
+        if (r->seq != seq)              // overwritten while being copied
+            continue;
+        k++;
+        traceTail++;
+    }
+    return k;
+}
+
+#else
+
+int TRACE_READ(TraceEvent *e, int n) {
+    return 0;
+}
+
+#endif
+
+/* execution time profiling */
+
+#ifdef	__USE_PROFILE
+
+// Add one execution of cycles to the statistics of meth. Called with
+// interrupts disabled.
+#define PROF_HASH(meth)     (((uint32_t) (meth) * 2654435761UL) / (0x100000000ULL / __PROFILE_ENTRIES))
+
+static void profile(Method meth, uint32_t cycles) {
+    uint32_t h = PROF_HASH(meth);
+    ProfileStats *e = NULL;
+    int i, bin;
+    for (i = 0; i < __PROFILE_ENTRIES; i++) {
+        e = &profTable[(h + i) & (__PROFILE_ENTRIES - 1)];
+        if (e->method == meth)
+            break;
+        if (!e->method) {
+            e->method = meth;
+            e->min = 0xffffffffUL;
+            break;
+        }
+    }
+    if (i == __PROFILE_ENTRIES) {
+        profDropped++;
+        return;
+    }
+    e->count++;
+    e->sum += cycles;
+    if (cycles < e->min)
+        e->min = cycles;
+    if (cycles > e->max)
+        e->max = cycles;
+    bin = 31 - __builtin_clz(cycles | 1);
+    if (bin >= __PROFILE_BINS)
+        bin = __PROFILE_BINS - 1;
+    e->hist[bin]++;
+}
+
+int PROFILE_STATS(ProfileStats *s, int n) {
+    int i, k = 0;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    for (i = 0; i < __PROFILE_ENTRIES && k < n; i++)
+        if (profTable[i].method)
+            s[k++] = profTable[i];
+    ENABLE(wasEnabled);
+    return k;
+}
+
+// Largest execution time profiled for meth, in cycles, 0 if none
+static uint32_t profMax(Method meth) {
+    uint32_t h = PROF_HASH(meth);
+    int i;
+    for (i = 0; i < __PROFILE_ENTRIES; i++) {
+        ProfileStats *e = &profTable[(h + i) & (__PROFILE_ENTRIES - 1)];
+        if (e->method == meth)
+            return e->max;
+        if (!e->method)
+            break;
+    }
+    return 0;
+}
+
+void PROFILE_RESET(void) {
+    static const ProfileStats empty;
+    int i;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    for (i = 0; i < __PROFILE_ENTRIES; i++)
+        profTable[i] = empty;
+    profDropped = 0;
+    ENABLE(wasEnabled);
+}
+
+#else
+
+int PROFILE_STATS(ProfileStats *s, int n) {
+    return 0;
+}
+
+void PROFILE_RESET(void) {
+}
+
+#endif
+
+#ifdef	__USE_CBS
+
+/* constant bandwidth servers */
+
+// The budget of s has run out: refill it, postpone its deadline and move
+// every message of s, released or running, to the new deadline.
+static void cbsReplenish(Server *s) {
+#ifdef	__USE_SRP
+    Msg m;
+#else
+    Thread t;
+#endif
+    int i;
+    while (s->remaining <= 0) {         // an overrun is paid from the next budget
+        s->remaining += s->budget;
+        s->deadline += s->period;
+    }
+    s->exhausted++;
+#ifdef	__USE_SRP
+    for (m = current->msg; m; m = m->next)  // nested on the single stack
+        if (m->server == s && !m->demoted)
+            m->deadline = s->deadline;
+#else
+    for (t = activeStack; t; t = t->next)
+        if (t->msg && t->msg->server == s && !t->msg->demoted)
+            t->msg->deadline = s->deadline;
+#endif
+    for (i = 0; i < readyCount; i++)
+        if (readyQ[i]->server == s)
+            readyQ[i]->deadline = s->deadline;
+    for (i = readyCount / 2 - 1; i >= 0; i--)
+        heapDown(i);
+}
+
+// Charge the time since the last call to the server that ran, and arm the
+// budget timer for next, the server that runs from now on. Called with
+// interrupts disabled.
+static void cbsCharge(Server *next, Time now) {
+    if (cbsRunning) {
+        cbsRunning->remaining -= now - cbsStamp;
+        if (cbsRunning->remaining <= 0)
+            cbsReplenish(cbsRunning);
+    }
+    cbsRunning = next;
+    cbsStamp = now;
+    if (next) {
+        TIMER_ARM(CBS_CHANNEL, now + next->remaining);
+    } else {
+        TIMER_DISARM(CBS_CHANNEL);
+    }
+}
+
+// CBS arrival rule: a message released to an idle server starts a new
+// server deadline, unless the remaining budget would then exceed the
+// reserved bandwidth up to the current deadline.
+static void cbsArrive(Msg m, Time now) {
+    Server *s = m->to->server;
+    if (!s)
+        return;
+    if (!s->pending && (int64_t)s->remaining * s->period >= (int64_t)(s->deadline - now) * s->budget) {
+        s->deadline = now + s->period;
+        s->remaining = s->budget;
+    }
+    s->pending++;
+    m->server = s;                      // even if obj changes server meanwhile
+    m->deadline = s->deadline;
+}
+
+void serve(Server *s, Object *obj) {
+    char wasEnabled = ENABLED();
+    if (s && (s->budget <= 0 || s->period < s->budget))
+        PANIC("Bad server");
+    DISABLE();
+    obj->server = s;
+    ENABLE(wasEnabled);
+}
+
+#else
+
+void serve(Server *s, Object *obj) {
+    PANIC("SERVE requires __USE_CBS");
+}
+
+#endif
+
+/* execution time budgets */
+
+#ifdef	__USE_BUDGET
+
+// Give m, which has just exceeded the budget of its receiver, to the
+// overrun hook and act on its verdict. Called with interrupts disabled.
+static void overrun(Msg m, Time now) {
+    int action = overrunHook ? overrunHook(m->to, m->method, m->used) : OVERRUN_DEMOTE;
+    m->overrun = 1;
+    sched.overruns++;
+    TRACE(TRACE_OVERRUN, m);
+    if (action == OVERRUN_CONTINUE)
+        return;
+    if (action == OVERRUN_STOP)
+        m->period = 0;                  // run() does not rearm it
+    m->deadline = now + NO_DEADLINE;
+    m->demoted = 1;
+}
+
+// Charge the time since the last call to the message that ran, and arm the
+// budget timer for next, the message that runs from now on. A message is
+// not timed any more once it has overrun. Called with interrupts disabled.
+static void budgetCharge(Msg next, Time now) {
+    Msg m = budgetRunning;
+    if (m) {
+        m->used += now - budgetStamp;
+        if (m->to->budget && !m->overrun && m->used >= m->to->budget)
+            overrun(m, now);
+    }
+    budgetRunning = next;
+    budgetStamp = now;
+    if (next && next->to->budget && !next->overrun) {
+        if (next->used >= next->to->budget)
+            overrun(next, now);         // the budget was lowered meanwhile
+        else {
+            TIMER_ARM(BUDGET_CHANNEL, now + next->to->budget - next->used);
+            return;
+        }
+    }
+    TIMER_DISARM(BUDGET_CHANNEL);
+}
+
+void budget(Object *obj, Time t) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    obj->budget = t > 0 ? t : 0;
+    ENABLE(wasEnabled);
+}
+
+void ON_OVERRUN(int (*hook)(Object*, Method, Time)) {
+    overrunHook = hook;
+}
+
+#else
+
+void budget(Object *obj, Time t) {
+    PANIC("BUDGET requires __USE_BUDGET");
+}
+
+void ON_OVERRUN(int (*hook)(Object*, Method, Time)) {
+    PANIC("ON_OVERRUN requires __USE_BUDGET");
+}
+
+#endif
+
+#if defined(__USE_CBS) || defined(__USE_BUDGET)
+
+// Charge the time since the last switch, to the server and the message
+// that ran, and start timing next. Called with interrupts disabled.
+static void charge(Msg next) {
+    Time now;
+    TIMERGET(now);
+#ifdef	__USE_CBS
+    cbsCharge(next ? next->server : NULL, now);
+#endif
+#ifdef	__USE_BUDGET
+    budgetCharge(next, now);
+#endif
+}
+
+#endif
+
+/* admission control */
+
+Activity *admitted  = NULL;             // activities that passed ADMIT
+unsigned int admitChanges = 0;          // changes of admitted, for admit()
+
+// The demand of one activity, in Time units
+struct demand {
+    int64_t c, t, d;
+};
+
+static void demandOf(struct demand *e, Activity *a) {
+    e->c = a->wcet;
+#ifdef	__USE_PROFILE
+    if (e->c <= 0 && a->method)         // rounded up to whole ticks
+        e->c = ((int64_t) profMax(a->method) * __TICKS_PER_SEC + CYCLES_PER_SEC - 1) / CYCLES_PER_SEC;
+#endif
+    e->t = a->period;
+    e->d = a->deadline > 0 ? a->deadline : a->period;
+}
+
+// EDF processor demand test of the n activities of set, released together
+// at time 0: the work with both release and deadline in [0, t] must fit in
+// t for every deadline t up to the end of the first busy period. With all
+// deadlines at least their periods a utilization of at most 1 is enough.
+static int feasible(struct demand *set, int n) {
+    uint64_t u = 0;                     // utilization in units of 2^-32, rounded up
+    int64_t busy = 0, w, t;
+    int i, j, constrained = 0, points = 0;
+    for (i = 0; i < n; i++) {
+        if (set[i].c <= 0 || set[i].t <= 0)
+            return 0;
+        u += ((uint64_t) set[i].c << 32) / set[i].t + 1;
+        if (set[i].d < set[i].t)
+            constrained = 1;
+        busy += set[i].c;
+    }
+    if (u > (1ULL << 32) + n)          // over 1 even without the rounding
+        return 0;
+    if (!constrained && u <= (1ULL << 32))
+        return 1;
+    do {                                // busy period: w = sum of ceil(w / t) * c
+        w = busy;
+        busy = 0;
+        for (i = 0; i < n; i++)
+            busy += (w + set[i].t - 1) / set[i].t * set[i].c;
+        if (++points > __ADMIT_POINTS || busy > INFINITY)
+            return 0;
+    } while (busy != w);
+    for (i = 0; i < n; i++)
+        for (t = set[i].d; t <= busy; t += set[i].t) {
+            int64_t h = 0;
+            if (++points > __ADMIT_POINTS)
+                return 0;
+            for (j = 0; j < n; j++)
+                if (t >= set[j].d)
+                    h += ((t - set[j].d) / set[j].t + 1) * set[j].c;
+            if (h > t)
+                return 0;
+        }
+    return 1;
+}
+
+// Remove a from the admitted activities. Called with interrupts disabled.
+static void unadmit(Activity *a) {
+    Activity **p;
+    for (p = &admitted; *p; p = &(*p)->next)
+        if (*p == a) {
+            *p = a->next;
+            admitChanges++;
+            break;
+        }
+}
+
+// The test runs with interrupts enabled, on a copy of the admitted
+// activities, and is repeated if they change meanwhile.
+int admit(Activity *a, Activity *old) {
+    struct demand set[__ADMIT_MAX];
+    unsigned int changes;
+    Activity *b;
+    int n, ok;
+    char wasEnabled = ENABLED();
+    while (1) {
+        DISABLE();
+        changes = admitChanges;
+        n = 0;
+        for (b = admitted; b; b = b->next) {
+            if (b == a && a != old)
+                PANIC("Activity already admitted");
+            if (b != old && n < __ADMIT_MAX - 1)
+                demandOf(&set[n], b);
+            if (b != old)
+                n++;
+        }
+        if (n < __ADMIT_MAX)
+            demandOf(&set[n], a);
+        n++;
+        ENABLE(wasEnabled);
+        ok = n <= __ADMIT_MAX && feasible(set, n);
+        DISABLE();
+        if (admitChanges == changes)
+            break;
+        ENABLE(wasEnabled);
+    }
+    if (ok && a != old) {
+        if (old)
+            unadmit(old);
+        a->next = admitted;
+        admitted = a;
+        admitChanges++;
+    }
+    ENABLE(wasEnabled);
+    return ok ? 0 : -1;
+}
+
+void WITHDRAW(Activity *a) {
+    char wasEnabled = ENABLED();
+    DISABLE();
+    unadmit(a);
+    ENABLE(wasEnabled);
+}
+
+// Count a miss of lateness late for the method of m, once per message.
+// Called with interrupts disabled.
+static void missed(Msg m, Time late) {
+    MissStats *e = missTable;
+    int i;
+    for (i = 0; i < missCount; i++, e++)
+        if (e->to == m->to && e->method == m->method)
+            break;
+    if (i == missCount) {
+        if (missCount < __MISS_ENTRIES - 1) {
+            e->to = m->to;
+            e->method = m->method;
+        } else {
+            e = &missTable[__MISS_ENTRIES - 1];
+        }
+        if (missCount < __MISS_ENTRIES)
+            missCount++;
+    }
+    if (!m->late) {
+        e->misses++;
+        m->late = 1;
+    }
+    if (late > e->maxLateness)
+        e->maxLateness = late;
+}
+
+// Compare the completion time of m with its deadline. Called from the
+// context of m with interrupts enabled, right after its method returned.
+static void completed(Msg m) {
+    Time now, late;
+    TIMERGET(now);
+    late = now - m->deadline;
+    if (late > 0) {
+        DISABLE();
+        missed(m, late);
+        ENABLE(1);
+        if (missHook)
+            missHook(m->to, m->method, late);
+    }
+}
+
+int MISS_STATS(MissStats *s, int n) {
+    int i;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    if (n > missCount)
+        n = missCount;
+    for (i = 0; i < n; i++)
+        s[i] = missTable[i];
+    ENABLE(wasEnabled);
+    return n;
+}
+
+void ON_DEADLINE_MISS(void (*hook)(Object*, Method, Time)) {
+    missHook = hook;
+}
+
+Time CURRENT_OFFSET(void) {
+    Time now;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    TIMERGET(now);
+    ENABLE(wasEnabled);
+	return now - (wasEnabled ? current->msg->baseline : timestamp);
+}
+
+// Extend t, which must lie within half the range of Time from the current
+// time, to 64 bits. The counter and the overflow count are read with the
+// timer interrupt masked; an overflow that is still pending is accounted
+// for if the counter was read after it.
+static Time64 extend(Time t) {
+    uint32_t lo;
+    Time64 now;
+    char wasEnabled = ENABLED();
+    DISABLE();
+    TIMERGET(lo);
+    now = ((Time64)overflows << 32) | lo;
+    if (TIMER_OVERFLOWED() && lo < 0x80000000UL)
+        now += 1LL << 32;
+    ENABLE(wasEnabled);
+    return now + (Time)(t - (Time)lo);
+}
+
+Time64 CURRENT_TIME64(void) {
+    Time now;
+    TIMERGET(now);
+    return extend(now);
+}
+
+Time64 BASELINE64(void) {
+    return extend(ENABLED() ? current->msg->baseline : timestamp);
+}
+
+/* initialization */
+static void initialize(void) {
+    int i;
+    
+    for (i=0; i<NMSGS-1; i++)
+        messages[i].next = &messages[i+1];
+    messages[NMSGS-1].next = NULL;
+    
+#ifndef	__USE_SRP
+    for (i=0; i<NTHREADS-1; i++)
+        threads[i].next = &threads[i+1];
+    threads[NTHREADS-1].next = NULL;
+    
+    for (i=0; i<NTHREADS; i++) {
+		threads[i].thread_no = i;
+        SETCONTEXT( threads[i].context );
+        SETSTACK( &threads[i].context, &stacks[i] );
+        SETPC( &threads[i].context, run );
+        threads[i].waitsFor = NULL;
+    }
+#endif
+
+    thread0.thread_no = -1;
+	thread0.next = NULL;
+    thread0.waitsFor = NULL;
+    thread0.msg = NULL;
+    
+#if (defined(__USE_TRACE) || defined(__USE_PROFILE)) && !defined(__HOST)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;   // time stamps
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    DUMP("\n\r");
+    DUMP("TinyTimber ");
+    DUMP(TINYTIMBER_VERSION);
+    DUMP("\n\r");
+    DUMP("\n\r");
+ 	
+    TIMER_INIT();
+}
+
+// Priority level of an interrupt with relative deadline dl: shorter
+// deadlines get more urgent levels, all below the timer
+static int irqLevel(Time dl) {
+    int l = 0;
+    if (dl <= 0)
+        return __IRQ_PRIORITY;
+    while (l < sizeof(irqLimits) / sizeof(Time) && dl > irqLimits[l])
+        l++;
+    return __TIMER_PRIORITY + 1 + l;
+}
+
+void install(Object *obj, Method m, enum Vector i, Time dl) {
+    if (i >= 0 && i < N_VECTORS) {
+        char wasEnabled = ENABLED();
+        DISABLE();
+        if ((IRQn_Type) i == TIM5_IRQn)
+            PANIC("Device IRQ not supported ...");   // the kernel timer
+        *((void (**)(void) ) DEVICE_IRQ_VECTOR(i) ) = vect_IRQ;
+        ltable[i] = irqLevel(dl);
+        NVIC_SetPriority((IRQn_Type) i, ltable[i]);     // masked by the kernel
+        otable[i] = obj;
+        mtable[i] = m;
+        obj->wantedBy = INSTALLED_TAG;  // Mark object as subject to synchronization by interrupt disabling
+        ENABLE(wasEnabled);
+    }
+}
+
+void mailbox_open(Mailbox *mb) {
+    char wasEnabled = ENABLED();
+    if (mb->size == 0 || (mb->size & (mb->size - 1)))
+        PANIC("Mailbox size not a power of two");
+    DISABLE();
+    mb->next = mailboxes;
+    mailboxes = mb;
+    ENABLE(wasEnabled);
+}
+
+// The producer side, lock-free: the slot is filled before head publishes it,
+// and only the kernel moves tail. PendSV, below every interrupt level,
+// takes the mail once all handlers have returned.
+int mailbox_post(Mailbox *mb, int arg) {
+    unsigned int head = mb->head;
+    Mail *slot;
+    if (head - mb->tail >= mb->size) {
+        mb->lost++;
+        return -1;
+    }
+    slot = &mb->ring[head & (mb->size - 1)];
+    slot->arg = arg;
+    slot->stamp = timestamp;
+    __DMB();
+    mb->head = head + 1;
+    mailPending = 1;
+    PENDSV_SET();
+    return 0;
+}
+
+// Turn posted values into messages, as if sent by the interrupt handler
+// that posted them, all in the caller's critical section. Values that find
+// the pool low stay where they are until a message is returned to it.
+// The caller makes the scheduling decision. Called with interrupts
+// disabled.
+static void drain(void) {
+    Mailbox *mb;
+    Time stamp = timestamp;
+    char wasHardware = runAsHardware;
+    mailPending = 0;                    // before looking, so that no post is missed
+    runAsHardware = 1;
+    for (mb = mailboxes; mb; mb = mb->next)
+        while (mb->tail != mb->head) {
+            Mail *slot = &mb->ring[mb->tail & (mb->size - 1)];
+            timestamp = slot->stamp;
+            if (!post(0, mb->dl, mb->to, mb->meth, slot->arg, NULL, 0, 0, POST_MAYFAIL)) {
+                mailPending = 1;        // pool low, see run()
+                break;
+            }
+            mb->tail++;
+        }
+    timestamp = stamp;
+    runAsHardware = wasHardware;
+}
+
+// Called from vect_PendSV before the context switch, once every interrupt
+// handler has returned: mail becomes messages, and upcoming is changed if
+// one of them should preempt. Under __USE_SRP, srp_run does the same.
+void pendsv_mail(void) {
+    if (mailPending) {
+        char wasEnabled = ENABLED();
+        DISABLE();
+        drain();
+        schedule();
+        ENABLE(wasEnabled);
+    }
+}
+
+int tinytimber(Object *obj, Method meth, int arg) {
+    DISABLE();
+    initialize();
+    if (meth != NULL) {
+		TIMERGET(timestamp);
+		runAsHardware = 1;
+        ASYNC(obj, meth, arg);
+		runAsHardware = 0;
+		schedule();
+	}
+    idle();
+    return 0;
+}
@@ -1,217 +1,693 @@
-// The Timber compiler <timber-lang.org>
-// 
-// Copyright 2008-2012 Johan Nordlander <nordland@csee.ltu.se>
-// All rights reserved.
-// 
-// Redistribution and use in source and binary forms, with or without
-// modification, are permitted provided that the following conditions
-// are met:
-// 
-// 1. Redistributions of source code must retain the above copyright
-//    notice, this list of conditions and the following disclaimer.
-// 
-// 2. Redistributions in binary form must reproduce the above copyright
-//    notice, this list of conditions and the following disclaimer in the
-//    documentation and/or other materials provided with the distribution.
-// 
-// 3. Neither the names of the copyright holder and any identified
-//    contributors, nor the names of their affiliations, may be used to 
-//    endorse or promote products derived from this software without 
-//    specific prior written permission.
-// 
-// THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS ``AS IS'' AND ANY EXPRESS
-// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
-// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
-// DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR
-// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
-// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
-// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
-// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
-// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
-// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
-// POSSIBILITY OF SUCH DAMAGE.
-
-/*
- * 
- * TinyTimber.h v2.0
- *
- */
-
-#ifndef _TINYTIMBER_
-#define _TINYTIMBER_
-
-#define TINYTIMBER_VERSION "v2.06a1 (2021-03-11)"
-
-#include "stm32f4xx.h"
-
-#define __USE_LOCAL_SBRK
-//#define __USE_SAFE_TIMER
-#define __USE_FUTURE_CHECK_TIMER
-
-#define __ENABLED_PRIORITY	3
-#define __DISABLED_PRIORITY	1
-#define __IRQ_PRIORITY		2
-
-//#define __TRACE_DISPATCH
-//#define __TRACE_RUN
-//#define __TRACE_TIMER
-//#define __TRACE_SCHEDULE
-//#define __TRACE_ASYNC
-
-extern int doIRQSchedule;
-
-//      Abstract type, used in the definition of Object.
-struct thread_block;
-
-//      Base class of reactive objects. Every reactive object in a TinyTimber 
-//      system must be of a class that inherits this class.
-typedef struct {
-    struct thread_block *ownedBy, *wantedBy;
-} Object;
-
-//      Initialization macro for class Object. 
-#define initObject() \
-        { NULL, NULL }
-
-//  int SYNC( T* obj, int (*meth)(T*, A), A arg );
-//      Synchronously invoke method meth on object obj with argument arg. Type T 
-//      must be a struct type that inherits from Object, while A can be any 
-//      int-sized type. If completion of the call would result in deadlock, 
-//      -1 is returned; otherwise the result is the value returned by m.
-#define SYNC(obj, meth, arg) \
-        sync((Object*)obj, (Method)meth, (int)arg)
-
-//      Abstract type, used in the definition of Msg
-struct msg_block;
-
-//      Type that identifies asynchronous messages
-typedef struct msg_block *Msg;
-
-//      Base type for methods. Every method in a TinyTimber system should take 
-//      a first argument that is a reference to a subclass of class Object.
-typedef int (*Method)(Object*, int);
-
-//      Unit pointer value.
-#ifndef NULL
-#define NULL 0
-#endif
-
-//  Msg ASYNC(T *obj, int (*meth)(T*, A), A arg);
-//      Asynchronously invoke method meth on object obj with argument arg. 
-//      Identical to SEND(0, 0, obj, meth, arg).
-#define ASYNC(obj, meth, arg) \
-        async((Time)0, (Time)0, (Object*)obj, (Method)meth, (int)arg)
-
-//  Msg AFTER(Time bl, T *obj, int (*meth)(T*, A), A arg);
-//      Asynchronously invoke method meth on object obj with argument arg and
-//      baseline offset bl. 
-//      Identical to SEND(bl, 0, obj, meth, arg).
-#define AFTER(bl, obj, meth, arg) \
-        async(bl, (Time)0, (Object*)obj, (Method)meth, (int)arg)
-
-//  Msg BEFORE(Time dl, T *obj, int (*meth)(T*, A), A arg);
-//      Asynchronously invoke method meth on object obj with argument arg and
-//      relative deadline dl. 
-//      Identical to SEND(0, dl, obj, meth, arg). 
-#define BEFORE(dl, obj, meth, arg) \
-        async((Time)0, dl, (Object*)obj, (Method)meth, (int)arg)
-
-//  Msg SEND(Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg);
-//      Asynchronously invoke method meth on object obj with argument arg, baseline 
-//      offset bl, and relative deadline dl. Type T must be a struct type that 
-//      inherits from Object, while A can be any int-sized type.
-//      Offsets bl and dl allow a new execution window for the asynchronous 
-//      call to be defined on basis of the current one:
-//         new baseline = current baseline + bl
-//         new deadline = new baseline + dl,    dl > 0
-//                      = new baseline + rel,   otherwise
-//      where rel = current deadline - current baseline.
-//      During interrupts, current baseline = time of interrupt and current
-//      deadline = infinity.
-#define SEND(bl, dl, obj, meth, arg) \
-        async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
-
-
-// Cortex m4 dependencies
-
-//      Type of time values (with platform-dependent resolution).
-typedef int32_t Time;
-
-#define __TIMER_PRESCALE    (840-1) // 10us tick @ 84 MHz, (See table 51 in F407 - Datasheet.pdf)
-
-//      Construct a Time value from an argument given in microseconds.
-#define USEC(x) \
-        ((Time)((x) / 10))
-//      Construct a Time value from an argument given in milliseconds.
-#define MSEC(x) \
-        ((Time)((x) * (Time)100))
-//      Construct a Time value from an argument given in seconds.
-#define SEC(x) \
-        ((Time)((x) * (Time)100000))
-//      Extract the microsecond fraction of a Time value
-#define USEC_OF(t) \
-        (long)((t) % ((Time)100000) * 10)
-//      Extract the millisecond fraction of a Time value
-#define MSEC_OF(t) \
-        (int)((t) % ((Time)100000) / 100)
-//      Extract the while second basis of a Time value
-#define SEC_OF(t) \
-        (int)((t) / ((Time)100000))
-
-enum Vector { 
-        IRQ_USART1, 
-        IRQ_CAN1,
-        IRQ_EXTI9_5,
-
-        N_VECTORS
-};
-
-// End of target dependencies
-
-//      Prematurely aborts pending asynchronous message m.  Does nothing if m 
-//      has already begun executing. 
-void ABORT(Msg m);
-
-// void INSTALL (T* obj, int (*meth)(T*, enum Vector), enum Vector i )
-//      Install method meth on object obj as an interrupt-handler for
-//      interrupt source i. Type T must be a struct type that inherits
-//      from Object. When an interrupt on i occurs, meth will be
-//      invoked on obj with i as its argument.
-#define INSTALL(obj,meth,i) install((Object*)obj, (Method)meth, i)
-
-//  int TINYTIMBER ( T* obj, int (*meth)(T*, A), A arg )
-//      Start up the TinyTimber system by invoking method meth on obj with
-//      argument arg; then handle all subsequent interrupts and timed
-//      events as they occur. Type T must be a struct type that inherits
-//      from Object, while A can be any int-sized type. This function never
-//      returns.
-#define TINYTIMBER(obj,meth,arg) tinytimber((Object*)obj, (Method)meth, (int)arg)
-
-//      Built-in type of primitive baseline timers
-typedef struct {
-    Time accum;
-} Timer;
-
-//      Initialization macro for Timer objects
-#define initTimer() { 0 }
-
-//      Reset timer t to the value of of current baseline
-void T_RESET(Timer *t);
-
-//      Return difference between current baseline and timer t
-Time T_SAMPLE(Timer *t);
-
-//      Return current time measured from current baseline
-Time CURRENT_OFFSET(void);
-
-
-// -------------------------------------------------------------------
-// No externally significant information below this line
-// -------------------------------------------------------------------
-
-Msg async(Time bl, Time dl, Object *to, Method m, int arg); 
-int sync(Object *to, Method m, int arg);
-void install(Object *obj, Method m, enum Vector index);
-int tinytimber(Object *obj, Method startup, int arg);
-
-#endif
+// The Timber compiler <timber-lang.org>
+// 
+// Copyright 2008-2012 Johan Nordlander <nordland@csee.ltu.se>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 
+// 3. Neither the names of the copyright holder and any identified
+//    contributors, nor the names of their affiliations, may be used to 
+//    endorse or promote products derived from this software without 
+//    specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS ``AS IS'' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * 
+ * TinyTimber.h v2.0
+ *
+ */
+
+#ifndef _TINYTIMBER_
+#define _TINYTIMBER_
+
+#define TINYTIMBER_VERSION "v2.06a1 (2021-03-11)"
+
+#include "stm32f4xx.h"
+
+#define __USE_LOCAL_SBRK
+//#define __USE_SAFE_TIMER
+#define __USE_FUTURE_CHECK_TIMER
+//#define __USE_1US_TIMEBASE	// 1us instead of 10us ticks (Time spans 35 minutes)
+//#define __USE_SRP				// run all methods on one stack (Stack Resource Policy)
+//#define __USE_CBS				// bandwidth reserving servers (see SERVE), uses a TIM5 compare channel
+//#define __USE_BUDGET			// execution time budgets (see BUDGET), uses a TIM5 compare channel
+
+// Interrupt priority levels (NVIC, lower is more urgent). Levels between
+// __DISABLED_PRIORITY and __PENDSV_PRIORITY preempt each other outside
+// the kernel. Masking is not per level: every level may post messages,
+// so every kernel critical section masks them all, the timer included,
+// and a handler on any level waits for the one in progress.
+#define __ENABLED_PRIORITY	15	// BASEPRI of methods: every level is let in
+#define __DISABLED_PRIORITY	1	// BASEPRI of critical sections
+#define __TIMER_PRIORITY	2	// TIM5, releases timed messages
+#define __IRQ_PRIORITY		13	// handlers installed without a deadline
+#define __PENDSV_PRIORITY	14	// context switches, once all handlers are done
+#ifndef __IRQ_LEVEL_LIMITS
+#define __IRQ_LEVEL_LIMITS { USEC(50), USEC(200), MSEC(1), MSEC(5) }  // longest deadline of levels 3, 4, ...
+#endif
+
+#ifndef NMSGS
+#define NMSGS				30	// size of the message pool
+#endif
+#ifndef __POOL_RESERVE
+#define __POOL_RESERVE		4	// pool messages that handlers installed without a deadline can not take
+#endif
+#ifndef __POOL_LEVEL_RESERVES
+#define __POOL_LEVEL_RESERVES { 1, 2, 3, 3 }  // the same for levels 3, 4, ... (the timer counts as 3)
+#endif
+#ifndef __MSG_PAYLOAD
+#define __MSG_PAYLOAD		16	// bytes of data a message can carry (see SEND_DATA)
+#endif
+#ifndef __MISS_ENTRIES
+#define __MISS_ENTRIES		16	// methods with separate deadline miss statistics
+#endif
+#ifndef __BATCH_SIZE
+#define __BATCH_SIZE		10	// messages in one Batch (see BATCH_SEND)
+#endif
+#ifndef __ADMIT_MAX
+#define __ADMIT_MAX			16	// activities that can be admitted (see ADMIT)
+#endif
+#ifndef __ADMIT_POINTS
+#define __ADMIT_POINTS		1000	// deadlines the admission test checks before it gives up
+#endif
+
+#ifndef __TIMER_CLASSES
+#define __TIMER_CLASSES		2	// timed message queues, one per TIM5 compare channel (1-4)
+#endif
+#ifndef __TIMER_CLASS_LIMITS	// longest relative deadline of each class but the last
+#if __TIMER_CLASSES == 1
+#define __TIMER_CLASS_LIMITS { }
+#elif __TIMER_CLASSES == 2
+#define __TIMER_CLASS_LIMITS { USEC(500) }
+#elif __TIMER_CLASSES == 3
+#define __TIMER_CLASS_LIMITS { USEC(200), MSEC(2) }
+#else
+#define __TIMER_CLASS_LIMITS { USEC(100), USEC(500), MSEC(5) }
+#endif
+#endif
+
+#define __USE_PROFILE			// net execution time of every method (see PROFILE_STATS)
+#ifndef __PROFILE_ENTRIES
+#define __PROFILE_ENTRIES	32	// methods that can be profiled, a power of two
+#endif
+#define __PROFILE_BINS		24	// log2 histogram, the last bin takes all longer times
+//#define __USE_TRACE			// record kernel events in a ring buffer (see TRACE_READ)
+#ifndef __TRACE_EVENTS
+#define __TRACE_EVENTS		128	// size of the trace ring, a power of two
+#endif
+
+extern int doIRQSchedule;
+
+//      Abstract type, used in the definition of Object.
+struct thread_block;
+struct server;
+
+//      Base class of reactive objects. Every reactive object in a TinyTimber 
+//      system must be of a class that inherits this class.
+typedef struct {
+    struct thread_block *ownedBy, *wantedBy;
+#ifdef __USE_SRP
+    int ceiling;        // shortest relative deadline of any caller, 0 if none
+#endif
+#ifdef __USE_CBS
+    struct server *server;  // serving the messages to this object, NULL if none
+#endif
+    int threshold;      // preemption threshold (relative deadline), 0 if none
+#ifdef __USE_BUDGET
+    int budget;         // execution time of each message to this object, 0 if unlimited
+#endif
+} Object;
+
+//      Initialization macro for class Object. 
+#ifdef __USE_SRP
+#define initObject() \
+        { NULL, NULL, 0 }
+#else
+#define initObject() \
+        { NULL, NULL }
+#endif
+
+//  int SYNC( T* obj, int (*meth)(T*, A), A arg );
+//      Synchronously invoke method meth on object obj with argument arg. Type T 
+//      must be a struct type that inherits from Object, while A can be any 
+//      int-sized type. If completion of the call would result in deadlock, 
+//      -1 is returned; otherwise the result is the value returned by m.
+#define SYNC(obj, meth, arg) \
+        sync((Object*)obj, (Method)meth, (int)arg)
+
+//      Abstract type, used in the definition of Msg
+struct msg_block;
+
+//      Type that identifies asynchronous messages
+typedef struct msg_block *Msg;
+
+//      Base type for methods. Every method in a TinyTimber system should take 
+//      a first argument that is a reference to a subclass of class Object.
+typedef int (*Method)(Object*, int);
+
+//      Unit pointer value.
+#ifndef NULL
+#define NULL 0
+#endif
+
+//  Msg ASYNC(T *obj, int (*meth)(T*, A), A arg);
+//      Asynchronously invoke method meth on object obj with argument arg. 
+//      Identical to SEND(0, 0, obj, meth, arg).
+#define ASYNC(obj, meth, arg) \
+        async((Time)0, (Time)0, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg AFTER(Time bl, T *obj, int (*meth)(T*, A), A arg);
+//      Asynchronously invoke method meth on object obj with argument arg and
+//      baseline offset bl. 
+//      Identical to SEND(bl, 0, obj, meth, arg).
+#define AFTER(bl, obj, meth, arg) \
+        async(bl, (Time)0, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg BEFORE(Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      Asynchronously invoke method meth on object obj with argument arg and
+//      relative deadline dl. 
+//      Identical to SEND(0, dl, obj, meth, arg). 
+#define BEFORE(dl, obj, meth, arg) \
+        async((Time)0, dl, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg SEND(Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      Asynchronously invoke method meth on object obj with argument arg, baseline 
+//      offset bl, and relative deadline dl. Type T must be a struct type that 
+//      inherits from Object, while A can be any int-sized type.
+//      Offsets bl and dl allow a new execution window for the asynchronous 
+//      call to be defined on basis of the current one:
+//         new baseline = current baseline + bl
+//         new deadline = new baseline + dl,    dl > 0
+//                      = new baseline + rel,   otherwise
+//      where rel = current deadline - current baseline.
+//      During interrupts, current baseline = time of interrupt and current
+//      deadline = infinity.
+#define SEND(bl, dl, obj, meth, arg) \
+        async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg TRY_SEND(Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//  Msg TRY_ASYNC(T *obj, int (*meth)(T*, A), A arg);
+//      As SEND and ASYNC, but return NULL instead of halting the system when
+//      the message pool is exhausted. Interrupt handlers can never take the
+//      last few messages, which are kept for methods so that a burst of
+//      interrupts can not starve timed messages: __POOL_LEVEL_RESERVES for
+//      handlers installed with INSTALL_BEFORE, by level, and __POOL_RESERVE
+//      for the rest. The more urgent a level, the deeper its handlers may
+//      dig, so a chatty handler with a long deadline can not use up the
+//      messages that one with a short deadline needs.
+#define TRY_SEND(bl, dl, obj, meth, arg) \
+        try_async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
+#define TRY_ASYNC(obj, meth, arg) \
+        try_async((Time)0, (Time)0, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg SEND_DATA(Time bl, Time dl, T *obj, int (*meth)(T*, P*), P *data);
+//  Msg ASYNC_DATA(T *obj, int (*meth)(T*, P*), P *data);
+//  Msg TRY_SEND_DATA(Time bl, Time dl, T *obj, int (*meth)(T*, P*), P *data);
+//  Msg TRY_ASYNC_DATA(T *obj, int (*meth)(T*, P*), P *data);
+//      As SEND, ASYNC, TRY_SEND and TRY_ASYNC, but *data is copied into the
+//      message itself and meth is invoked with a pointer to the copy, which
+//      stays valid until meth returns. P can be any type of at most
+//      __MSG_PAYLOAD bytes, e.g. a received CAN frame, so that an interrupt
+//      handler can pass it on without a buffer of its own.
+#define SEND_DATA(bl, dl, obj, meth, data) \
+        async_data(bl, dl, (Object*)obj, (Method)meth, data, sizeof(*(data)), 0)
+#define ASYNC_DATA(obj, meth, data) \
+        async_data((Time)0, (Time)0, (Object*)obj, (Method)meth, data, sizeof(*(data)), 0)
+#define TRY_SEND_DATA(bl, dl, obj, meth, data) \
+        async_data(bl, dl, (Object*)obj, (Method)meth, data, sizeof(*(data)), 1)
+#define TRY_ASYNC_DATA(obj, meth, data) \
+        async_data((Time)0, (Time)0, (Object*)obj, (Method)meth, data, sizeof(*(data)), 1)
+
+//  Msg SEND_IRQ(Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//  Msg PERIODIC_IRQ(Time period, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      As SEND and PERIODIC, but meth is a hardware task: it is invoked
+//      directly by the timer interrupt when its baseline arrives, without
+//      a thread, a context switch or a pass through the ready queue. If a
+//      method or another hardware task holds obj at that moment, the call
+//      is made as an ordinary message instead. Deadline dl is only used then and for the miss
+//      statistics. meth must be short, must not call SYNC on objects that
+//      methods use, and runs with the timer masked (or with interrupts
+//      disabled, if its baseline had already passed when it was sent).
+#define SEND_IRQ(bl, dl, obj, meth, arg) \
+        hard_async(bl, dl, (Time)0, (Object*)obj, (Method)meth, (int)arg)
+#define PERIODIC_IRQ(period, dl, obj, meth, arg) \
+        hard_async(period, dl, period, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg PERIODIC(Time period, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      Invoke method meth on object obj with argument arg every period,
+//      starting at current baseline + period, each time with relative 
+//      deadline dl (as for SEND). The kernel re-arms the same message after
+//      every run, so a periodic activity permanently holds one message
+//      of the pool and its releases do not drift. ABORT ends the series;
+//      an instance that has already begun executing is the last one.
+#define PERIODIC(period, dl, obj, meth, arg) \
+        periodic(period, dl, (Object*)obj, (Method)meth, (int)arg)
+
+
+// Cortex m4 dependencies
+
+//      Type of time values (with platform-dependent resolution). Time
+//      wraps around; two values can only be compared through their
+//      difference, and only when they are less than half the range apart.
+typedef int32_t Time;
+
+//      Type of time values that never wrap, counted from startup.
+typedef int64_t Time64;
+
+#ifdef __USE_1US_TIMEBASE
+#define __TIMER_PRESCALE    (84-1)  // 1us tick @ 84 MHz, (See table 51 in F407 - Datasheet.pdf)
+#define __TICKS_PER_SEC     1000000
+#else
+#define __TIMER_PRESCALE    (840-1) // 10us tick @ 84 MHz, (See table 51 in F407 - Datasheet.pdf)
+#define __TICKS_PER_SEC     100000
+#endif
+#define __USEC_PER_TICK     (1000000 / __TICKS_PER_SEC)
+
+//      Construct a Time value from an argument given in microseconds.
+#define USEC(x) \
+        ((Time)((x) / __USEC_PER_TICK))
+//      Construct a Time value from an argument given in milliseconds.
+#define MSEC(x) \
+        ((Time)((x) * (Time)(__TICKS_PER_SEC / 1000)))
+//      Construct a Time value from an argument given in seconds.
+#define SEC(x) \
+        ((Time)((x) * (Time)__TICKS_PER_SEC))
+//      Extract the microsecond fraction of a Time value
+#define USEC_OF(t) \
+        (long)((t) % ((Time)__TICKS_PER_SEC) * __USEC_PER_TICK)
+//      Extract the millisecond fraction of a Time value
+#define MSEC_OF(t) \
+        (int)((t) % ((Time)__TICKS_PER_SEC) / (__TICKS_PER_SEC / 1000))
+//      Extract the while second basis of a Time value
+#define SEC_OF(t) \
+        (int)((t) / ((Time)__TICKS_PER_SEC))
+
+// Interrupt sources are the NVIC lines of stm32f4xx.h, so any IRQn_Type
+// but the kernel's own TIM5_IRQn may be installed (DMA2_Stream0_IRQn,
+// TIM3_IRQn, ...). The names below are those used by the drivers.
+enum Vector { 
+        IRQ_USART1  = USART1_IRQn, 
+        IRQ_CAN1    = CAN1_RX0_IRQn,
+        IRQ_EXTI9_5 = EXTI9_5_IRQn,
+
+        N_VECTORS   = FPU_IRQn + 1
+};
+
+// End of target dependencies
+
+//      Prematurely aborts pending asynchronous message m.  Does nothing if m 
+//      has already begun executing. 
+void ABORT(Msg m);
+
+//      Change the period of periodic message m. A pending release is moved
+//      to previous release + period; otherwise the new period applies from
+//      the next release.
+void SET_PERIOD(Msg m, Time period);
+
+// void CEILING(T* obj, Time dl)
+//      Declare that methods with relative deadline dl may call obj through
+//      SYNC. Only meaningful with __USE_SRP, where all methods share one
+//      stack and a method may only start when every object it can reach is
+//      free. The kernel learns the ceiling of the receiver of each message
+//      by itself, but an object that is only reached by a nested SYNC must
+//      be declared before such a call can find it locked; when that happens
+//      SYNC returns -1 instead of blocking.
+#ifdef __USE_SRP
+#define CEILING(obj, dl) ceiling((Object*)obj, dl)
+#else
+#define CEILING(obj, dl)
+#endif
+
+// void THRESHOLD(T* obj, Time dl)
+//      Set the preemption threshold of obj. While a message to obj runs, it
+//      is only preempted by messages with an earlier deadline (as always)
+//      and a relative deadline shorter than dl. Messages with deadlines
+//      close to each other then run one after the other instead of
+//      preempting each other, which saves context switches and threads,
+//      at the price of bounded blocking: a message with a relative deadline
+//      of dl or more may have to wait for one message to obj to complete.
+//      With dl 0, the default, obj has no threshold.
+#define THRESHOLD(obj, dl) threshold((Object*)obj, dl)
+
+// void BUDGET(T* obj, Time t)
+//      Allow every message to obj at most t time units of execution,
+//      counted while it is the running message (interrupt handlers that
+//      run meanwhile included). A message that exceeds its budget is given
+//      to the overrun hook (see ON_OVERRUN) and, unless that says
+//      otherwise, demoted: it continues with no deadline, so that every
+//      message released after it preempts it, and its receiver's
+//      preemption threshold no longer applies. With t 0, the default, obj
+//      has no budget. Requires __USE_BUDGET.
+#define BUDGET(obj, t) budget((Object*)obj, t)
+
+//      What the kernel does with a message that exceeded its budget. A
+//      method is never cut short: even a stopped one runs to its end.
+#define OVERRUN_CONTINUE    0   // nothing, it keeps its deadline
+#define OVERRUN_DEMOTE      1   // continue with no deadline
+#define OVERRUN_STOP        2   // demote, and release it no more if periodic
+
+// void ON_OVERRUN(int (*hook)(Object*, Method, Time));
+//      Call hook with the receiver, method and execution time so far of
+//      every message that exceeds its budget, and act on the OVERRUN_
+//      value it returns. The hook runs with interrupts disabled, possibly
+//      in the timer interrupt, so it must be short and may not call the
+//      kernel; it can count or record what happened for a method to report.
+//      NULL, the default, demotes every such message.
+void ON_OVERRUN(int (*hook)(Object*, Method, Time));
+
+// void INSTALL (T* obj, int (*meth)(T*, enum Vector), enum Vector i )
+//      Install method meth on object obj as an interrupt-handler for
+//      interrupt source i. Type T must be a struct type that inherits
+//      from Object. When an interrupt on i occurs, meth will be
+//      invoked on obj with i as its argument. The line is given priority
+//      __IRQ_PRIORITY; enabling it in the NVIC and in the device is left
+//      to the caller.
+#define INSTALL(obj,meth,i) install((Object*)obj, (Method)meth, (enum Vector)(i), (Time)0)
+
+// void INSTALL_BEFORE (Time dl, T* obj, int (*meth)(T*, enum Vector), enum Vector i )
+//      As INSTALL, for an interrupt that must be handled within dl of its
+//      occurrence. The line is given the first priority level of
+//      __IRQ_LEVEL_LIMITS that dl fits in, so that handlers with shorter
+//      deadlines preempt those with longer ones. Only the timer interrupt
+//      preempts them all.
+#define INSTALL_BEFORE(dl,obj,meth,i) install((Object*)obj, (Method)meth, (enum Vector)(i), dl)
+
+//      Constant Bandwidth Server: the messages to its objects together get
+//      at most budget time units in every period. Their deadlines are not
+//      those they were sent with, but the server deadline, which the kernel
+//      assigns when a message is released to an idle server and postpones
+//      by one period each time the budget runs out, at which point the
+//      budget is refilled. Work of a server can thus never take more than
+//      budget/period of the processor away from messages with earlier
+//      deadlines, however long it runs.
+typedef struct server {
+    Time budget;                    // Q
+    Time period;                    // P
+    Time remaining;                 // budget left in the current period
+    Time deadline;                  // server deadline
+    int pending;                    // messages released and not completed
+    int exhausted;                  // times the budget ran out
+} Server;
+
+//  Server initServer(Time budget, Time period);
+#define initServer(budget, period) \
+        { budget, period, 0, 0, 0, 0 }
+
+// void SERVE(Server *s, T *obj)
+//      Let s serve all messages to obj that are released from now on; with
+//      s NULL, obj is no longer served. Messages released before stay with
+//      their server until they complete. Requires __USE_CBS.
+#define SERVE(s, obj) serve(s, (Object*)obj)
+
+//      A slot of a mailbox: the value posted and the time of the interrupt.
+typedef struct {
+    int arg;
+    Time stamp;
+} Mail;
+
+//      Single producer, single consumer queue from one interrupt handler to
+//      a method. Posting never disables interrupts; the kernel turns posted
+//      values into messages in PendSV, once every interrupt handler has
+//      returned, all of them in one critical section.
+typedef struct mailbox {
+    Object *to;                     // receiver
+    Method meth;                    // invoked with each posted value
+    Time dl;                        // relative deadline, 0 as for ASYNC
+    Mail *ring;                     // size slots
+    unsigned int size;              // a power of two
+    volatile unsigned int head;     // advanced by the producer only
+    volatile unsigned int tail;     // advanced by the kernel only
+    int lost;                       // posts that found the mailbox full
+    struct mailbox *next;           // list of opened mailboxes
+} Mailbox;
+
+//  Mailbox initMailbox(T *obj, int (*meth)(T*, A), Time dl, Mail ring[]);
+//      Initialization macro for a mailbox delivering to meth on obj, with
+//      relative deadline dl and the slots of array ring (a power of two).
+#define initMailbox(obj, meth, dl, ring) \
+        { (Object*)obj, (Method)meth, dl, ring, sizeof(ring)/sizeof(Mail), 0, 0, 0, NULL }
+
+// void MAILBOX_OPEN(Mailbox *mb)
+//      Make mb known to the kernel. Must be done, from a method, before
+//      anything is posted.
+#define MAILBOX_OPEN(mb) mailbox_open(mb)
+
+// int MAILBOX_POST(Mailbox *mb, A arg)
+//      Post arg to mb, for a call meth(obj, arg) at baseline = time of the
+//      interrupt. Only one interrupt handler may post to a given mailbox.
+//      Returns 0, or -1 if mb is full and arg is lost. A value that finds
+//      the message pool low stays in the mailbox until a message completes.
+#define MAILBOX_POST(mb, arg) mailbox_post(mb, (int)arg)
+
+//      Messages collected by BATCH_SEND, to be sent together
+typedef struct {
+    int count;
+    struct {
+        Time bl, dl;
+        Object *to;
+        Method meth;
+        int arg;
+    } msg[__BATCH_SIZE];
+} Batch;
+
+//  Batch initBatch();
+#define initBatch() \
+        { 0 }
+
+// void BATCH_SEND(Batch *b, Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg)
+//      Add SEND(bl, dl, obj, meth, arg) to b, to be sent by BATCH_SUBMIT.
+//      Halts the system if b already holds __BATCH_SIZE messages.
+#define BATCH_SEND(b, bl, dl, obj, meth, arg) \
+        batch_send(b, bl, dl, (Object*)obj, (Method)meth, (int)arg)
+
+// int BATCH_SUBMIT(Batch *b)
+//      Send the messages of b, in the order they were added, within one
+//      critical section, and only then decide whether any of them preempts
+//      the caller; b is empty afterwards. A method that sends several
+//      messages at once thus pays for one critical section and at most
+//      one context switch. Either all messages are sent and 0 is returned,
+//      or, if the pool can not hold them all, none is sent and -1 is
+//      returned (counted as failures in PoolStats).
+#define BATCH_SUBMIT(b) batch_submit(b)
+
+//      A periodic or sporadic activity, as declared to admission control:
+//      messages released at most once per period, each of which must
+//      complete within deadline of its release and runs for at most wcet.
+//      With wcet 0, the largest execution time profiled for method
+//      (__USE_PROFILE) is used, as measured at the time of each test.
+typedef struct activity {
+    Time period;                    // period, or minimum time between releases
+    Time deadline;                  // relative deadline, 0 for period
+    Time wcet;                      // worst case execution time, 0 if measured
+    Method method;                  // measured for wcet 0
+    struct activity *next;          // list of admitted activities
+} Activity;
+
+//  Activity initActivity(Time period, Time dl, Time wcet, int (*meth)(T*, A));
+#define initActivity(period, dl, wcet, meth) \
+        { period, dl, wcet, (Method)meth, NULL }
+
+// int ADMIT(Activity *a)
+//      Admit a if it and the activities already admitted pass the EDF
+//      processor demand test: for every deadline up to the end of the
+//      first busy period, the work released and due by then fits. Returns
+//      0 if a is admitted, or -1 if the set would not be schedulable, or
+//      can not be shown to be within __ADMIT_POINTS deadlines; a is then
+//      not admitted, and the caller may degrade it (a longer period, less
+//      work) and try again, or withdraw something else. An activity with
+//      no known execution time is never admitted. Admission is
+//      bookkeeping only: the messages themselves are sent as usual.
+#define ADMIT(a) admit(a, NULL)
+
+// int ADMIT_INSTEAD(Activity *a, Activity *old)
+//      As ADMIT, for a in place of admitted activity old, e.g. a new period
+//      or workload of the same work. If a is not admitted, old remains.
+#define ADMIT_INSTEAD(a, old) admit(a, old)
+
+// void WITHDRAW(Activity *a)
+//      Remove a from the admitted activities; nothing happens if a is not
+//      admitted.
+void WITHDRAW(Activity *a);
+
+//  int TINYTIMBER ( T* obj, int (*meth)(T*, A), A arg )
+//      Start up the TinyTimber system by invoking method meth on obj with
+//      argument arg; then handle all subsequent interrupts and timed
+//      events as they occur. Type T must be a struct type that inherits
+//      from Object, while A can be any int-sized type. This function never
+//      returns.
+#define TINYTIMBER(obj,meth,arg) tinytimber((Object*)obj, (Method)meth, (int)arg)
+
+//      Built-in type of primitive baseline timers
+typedef struct {
+    Time accum;
+} Timer;
+
+//      Initialization macro for Timer objects
+#define initTimer() { 0 }
+
+//      Reset timer t to the value of of current baseline
+void T_RESET(Timer *t);
+
+//      Return difference between current baseline and timer t
+Time T_SAMPLE(Timer *t);
+
+//      Return current time measured from current baseline
+Time CURRENT_OFFSET(void);
+
+//      Return the time since startup, in Time units, as a value that does
+//      not wrap around in the lifetime of the system
+Time64 CURRENT_TIME64(void);
+
+//      Return current baseline in the same form as CURRENT_TIME64
+Time64 BASELINE64(void);
+
+//      Message pool statistics
+typedef struct {
+    int size;           // NMSGS
+    int inUse;          // messages currently allocated
+    int highWater;      // largest inUse since startup
+    int failures;       // allocations refused by TRY_SEND, TRY_ASYNC and BATCH_SUBMIT
+} PoolStats;
+
+//      Copy the current message pool statistics to s
+void POOL_STATS(PoolStats *s);
+
+//      Preemption statistics
+typedef struct {
+    int preemptions;    // messages started on top of a running one
+    int avoided;        // messages held back by a preemption threshold
+    int depth;          // messages currently running or preempted
+    int maxDepth;       // largest depth since startup (threads in use, or
+                        // nesting on the single stack with __USE_SRP)
+    int overruns;       // messages that exceeded their budget (see BUDGET)
+} SchedStats;
+
+//      Copy the current preemption statistics to s
+void SCHED_STATS(SchedStats *s);
+
+//      Deadline miss statistics of one method. The last of the
+//      __MISS_ENTRIES entries collects all methods that did not get one
+//      of their own, with to and method set to NULL.
+typedef struct {
+    Object *to;
+    Method method;
+    int misses;         // messages that completed after their deadline
+    Time maxLateness;   // largest completion time - deadline
+} MissStats;
+
+//      Copy the statistics of at most n methods that have missed a deadline
+//      to s, and return the number of entries copied
+int MISS_STATS(MissStats *s, int n);
+
+//  void ON_DEADLINE_MISS(void (*hook)(Object*, Method, Time));
+//      Call hook with the receiver, method and lateness of every message
+//      that completes after its deadline. The hook runs in the context of
+//      the late message, just after it, so it may send messages; NULL 
+//      removes the hook.
+void ON_DEADLINE_MISS(void (*hook)(Object*, Method, Time));
+
+//      Kernel trace events, recorded with __USE_TRACE
+enum TraceType {
+        TRACE_DISPATCH = 1,     // arg: number of the thread switched to
+        TRACE_RELEASE,          // arg: message moved to the ready queue
+        TRACE_RUN_START,        // arg: method
+        TRACE_RUN_END,          // arg: method
+        TRACE_SYNC_BLOCK,       // arg: locked object
+        TRACE_ABORT,            // arg: message
+        TRACE_IRQ_ENTRY,        // arg: IRQn (TIM5_IRQn for the timer)
+        TRACE_IRQ_EXIT,         // arg: as for TRACE_IRQ_ENTRY
+        TRACE_OVERRUN           // arg: message over its budget
+};
+
+typedef struct {
+    uint32_t seq;       // event number + 1, consecutive unless events were lost
+    uint32_t cycles;    // DWT cycle counter
+    uint8_t type;       // enum TraceType
+    int8_t thread;      // thread at the time of the event, -1 for idle
+    uint16_t unused;
+    uint32_t arg;
+} TraceEvent;
+
+//      Copy at most n of the oldest unread trace events to e and return the
+//      number copied. Recording never waits for the reader; events that are
+//      overwritten before they are read show up as gaps in seq.
+int TRACE_READ(TraceEvent *e, int n);
+
+//      Execution time statistics of one method, in cycles of the core clock.
+//      Times are net: time spent in interrupt handlers, in other threads
+//      and blocked in SYNC is not included, calls made through SYNC are.
+typedef struct {
+    Method method;
+    uint32_t count;                 // completed executions
+    uint32_t min, max;
+    uint64_t sum;                   // mean = sum / count
+    uint32_t hist[__PROFILE_BINS];  // hist[i]: 2^i to 2^(i+1)-1 cycles
+} ProfileStats;
+
+//      Copy the statistics of at most n profiled methods (__USE_PROFILE) to
+//      s and return the number of entries copied. Interrupt handlers
+//      installed with INSTALL are included.
+int PROFILE_STATS(ProfileStats *s, int n);
+
+//      Clear all execution time statistics
+void PROFILE_RESET(void);
+
+//  void SIM_COST(int (*meth)(T*, A), int nsec);
+//      Simulation build only (make sim, see hostTinyTimber.c): every call
+//      of meth takes nsec nanoseconds of virtual time. With meth NULL, set
+//      the cost of all methods not given one (0 by default). Does nothing
+//      in other builds.
+#ifdef __SIM
+#define SIM_COST(meth, nsec) \
+        sim_cost((Method)meth, nsec)
+#else
+#define SIM_COST(meth, nsec)
+#endif
+
+
+// -------------------------------------------------------------------
+// No externally significant information below this line
+// -------------------------------------------------------------------
+
+Msg async(Time bl, Time dl, Object *to, Method m, int arg); 
+Msg try_async(Time bl, Time dl, Object *to, Method m, int arg);
+Msg async_data(Time bl, Time dl, Object *to, Method m, const void *data, int size, int mayFail);
+Msg periodic(Time period, Time dl, Object *to, Method m, int arg);
+Msg hard_async(Time bl, Time dl, Time period, Object *to, Method m, int arg);
+int sync(Object *to, Method m, int arg);
+void ceiling(Object *obj, Time dl);
+void install(Object *obj, Method m, enum Vector index, Time dl);
+void mailbox_open(Mailbox *mb);
+int mailbox_post(Mailbox *mb, int arg);
+void serve(Server *s, Object *obj);
+void threshold(Object *obj, Time dl);
+void batch_send(Batch *b, Time bl, Time dl, Object *to, Method meth, int arg);
+int batch_submit(Batch *b);
+int admit(Activity *a, Activity *old);
+void budget(Object *obj, Time t);
+int tinytimber(Object *obj, Method startup, int arg);
+#ifdef __SIM
+void sim_cost(Method meth, int nsec);
+#endif
+
+#endif
@@ -60,11 +60,12 @@ typedef struct {
     bool high;
     bool mute;
     bool stop;
+    Msg edge; // periodic toggle message, NULL when silent
     
 } ToneGenerator;
 
 MusicPlayer musicPlayer = { initObject(), ' ', 0, 120, 0, {}, {}, 0, -1, false, false, initTimer(), initTimer(), 0, true};
-ToneGenerator toneGenerator = { initObject(), 500, 1, false, false, false};
+ToneGenerator toneGenerator = { initObject(), 500, 1, false, false, false, NULL};
 
 //Pointer declarations
 volatile unsigned int * addr_dac = (volatile unsigned int * )0x4000741C;
@@ -83,6 +84,7 @@ void checkLongPress(MusicPlayer*, int);
 void startApp(MusicPlayer*, int);
 
 void start(ToneGenerator*, int);
+void toggle(ToneGenerator*, int);
 void stop(ToneGenerator*, int);
 void enablePlay(ToneGenerator*, int);
 
@@ -114,41 +116,53 @@ void playMelody(MusicPlayer* self, int unused) {
     Time toneLength = beatLength * toneLengthFactor[self->currentMelodyIndex];
     int currentToneIndex = melody[self->currentMelodyIndex];
     int currentPeriod = period[currentToneIndex + 10 + self->key];
+    Batch batch = initBatch(); // all messages of this note are sent together
     SYNC(&toneGenerator, setPeriod, currentPeriod);
     SYNC(&toneGenerator, enablePlay, 0);
     
-    BEFORE(MSEC(1), &toneGenerator, start, 0); // Start tone
-    SEND(toneLength - MSEC(50), MSEC(1), &toneGenerator, stop, 0); // End tone
-    SEND(toneLength, MSEC(1), self, playMelody, 0); // Call to play next note in melody
+    BATCH_SEND(&batch, 0, MSEC(1), &toneGenerator, start, 0); // Start tone
+    BATCH_SEND(&batch, toneLength - MSEC(50), MSEC(1), &toneGenerator, stop, 0); // End tone
+    BATCH_SEND(&batch, toneLength, MSEC(1), self, playMelody, 0); // Call to play next note in melody
 
     // Blinking
     switch (blinkCountFactor[self->currentMelodyIndex]) {
     case 2: // half note
-       SEND(beatLength, MSEC(1), &sio0, sio_write, 0);
-       SEND(beatLength + beatLength/2, MSEC(1), &sio0, sio_write, 1);
+       BATCH_SEND(&batch, beatLength, MSEC(1), &sio0, sio_write, 0);
+       BATCH_SEND(&batch, beatLength + beatLength/2, MSEC(1), &sio0, sio_write, 1);
     case 1: // on beat
-       SEND(0, MSEC(1), &sio0, sio_write, 0);
-       SEND(beatLength/2, MSEC(1), &sio0, sio_write, 1);
+       BATCH_SEND(&batch, 0, MSEC(1), &sio0, sio_write, 0);
+       BATCH_SEND(&batch, beatLength/2, MSEC(1), &sio0, sio_write, 1);
     }
+    BATCH_SUBMIT(&batch);
 
     // Increment melody index
     self->currentMelodyIndex = (self->currentMelodyIndex + 1) % 32;
 }
 
 void start(ToneGenerator* self, int not_used) {
+    if (self->stop || self->edge)
+        return;
+
+    toggle(self, 0);
+    self->edge = PERIODIC(USEC(self->period), USEC(TONE_DEADLINE), self, toggle, 0);
+}
+
+void toggle(ToneGenerator* self, int not_used) {
     self->high = !self->high;
 
     if (self->high && !self->mute) 
         *addr_dac = (self->volume);
     else
         *addr_dac = 0;
-
-    if (!self->stop)
-        SEND(USEC(self->period), USEC(TONE_DEADLINE), self, start, 0);
 }
 
 void stop(ToneGenerator* self, int unused){
     self->stop = true;
+
+    if (self->edge) {
+        ABORT(self->edge);
+        self->edge = NULL;
+    }
 }
 
 void enablePlay(ToneGenerator* self, int unused) {
@@ -0,0 +1,434 @@
+/* KERNEL BENCHMARK
+
+Build with 'make bench' and load Debug/RTS-Bench.s19 instead of
+Debug/RTS-Lab.s19. Results are printed on the serial port as CSV lines:
+
+    test,param,mean_cycles,max_cycles
+
+Cycle counts are read from the DWT cycle counter (168 MHz core clock).
+The benchmark kernel is built with a larger message pool (see BENCHFLAGS
+in the Makefile) so that the ready queue can hold 256 pending messages.
+
+readyq_insert - cost of one BEFORE() into a ready queue of 'param' messages
+readyq_dequeue - run() overhead from the end of one method to the start of
+                 the next, with 'param' messages pending
+switch_preempt - from a BEFORE() that preempts the caller to the entry of
+                 the new method; param 1 if the caller has floating point
+                 state that must be saved, 0 if it is integer-only
+async_idle     - ASYNC() to an idle object that does not preempt the caller
+async_preempt  - BEFORE() that preempts the caller through dispatch(), from
+                 the call until it returns (the method called is empty)
+sync_free      - SYNC() of an empty method on an unlocked object
+sync_contended - SYNC() on an object locked by a preempted thread, until the
+                 call returns; includes the rest of the owner's method,
+                 which returns at once
+abort_ready    - ABORT() of a message in a ready queue of 'param' messages
+abort_timed    - ABORT() of a message among 'param' timed messages
+timer_release  - from the TIM5 compare match to the entry of the method
+                 released (measured by a thread spinning on the counter)
+irq_handler    - from setting an interrupt pending to the entry of the
+                 method installed with INSTALL(), through the kernel's
+                 shared vector (vect_IRQ), which finds the method by the
+                 number of the active vector
+irq_method     - as irq_handler, to the entry of a method the handler sends
+                 with a deadline that preempts the interrupted thread
+prof_outer     - the profiled time (PROFILE_STATS) of a handler that spins
+                 2 * SPIN cycles and halfway sets pending a handler on a
+                 higher level, which preempts it; param is SPIN. It should
+                 not include the time of the nested handler
+prof_inner     - the profiled time of that nested handler, which spins
+                 SPIN cycles
+
+The lines come in a fixed order, so the output of two kernel versions can
+be compared with diff.
+
+Comparing with older kernels: the benchmark kernel gets -DNMSGS=300
+from BENCHFLAGS. Kernels before the heap ready queue define NMSGS as 30
+inside TinyTimber.c, which ignores the flag, so the define must be
+raised to 300 there by hand or the 256 deep tests halt on an empty pool.
+This file has since grown tests that use later API (TRY_SEND, INSTALL on
+any NVIC line); for the readyq_* baseline use benchmark.c as it was when
+the heap ready queue was introduced, which only uses BEFORE, ASYNC and
+ABORT.
+
+*/
+
+#include "TinyTimber.h"
+#include "sciTinyTimber.h"
+#include "stm32f4xx_tim.h"
+#include <stdio.h>
+
+#define N_SAMPLES 8
+#define SPIN 1000                   // cycles spent by the nested handlers
+
+const int depths[] = { 8, 30, 256 };
+#define N_DEPTHS (sizeof depths / sizeof depths[0])
+
+typedef struct {
+    unsigned int sum;
+    unsigned int max;
+    int n;
+} Stat;
+
+typedef struct {
+    Object super;
+    int step;               // index into depths[]
+    int pending;            // sink messages not yet executed
+    unsigned int seed;
+    unsigned int lastExit;  // cycle count when the previous method returned
+    unsigned int t0;        // cycle count when a timed call was made
+    float f;                // touched to give a thread floating point state
+    volatile int released;  // set by the method under test
+    volatile unsigned int entry;    // cycle count at its entry
+    volatile unsigned int irqEntry; // cycle count at entry of the handler
+    Stat insert[N_DEPTHS];
+    Stat dequeue[N_DEPTHS];
+    Stat preempt[2];
+    Stat asyncIdle;
+    Stat asyncPreempt;
+    Stat syncFree;
+    Stat syncContended;
+    Stat abortReady[N_DEPTHS];
+    Stat abortTimed[N_DEPTHS];
+    Stat timerRelease;
+    Stat irqHandler;
+    Stat irqMethod;
+    ProfileStats profOuter;
+    ProfileStats profInner;
+} Bench;
+
+typedef struct {
+    Object super;
+} Probe;
+
+Bench bench = { initObject(), 0, 0, 12345, 0, 0, 1.0f };
+Probe probe = { initObject() };
+Probe resource = { initObject() };
+Probe device = { initObject() };    // installed as EXTI9_5 handler
+Probe outer = { initObject() };     // EXTI0, preempted by
+Probe inner = { initObject() };     // EXTI1 on a higher level
+
+Msg fill[256];                      // queued to give ABORT a queue depth
+
+void benchStart(Bench*, int);
+void benchQueue(Bench*, int);
+void benchSwitch(Bench*, int);
+void sink(Bench*, int);
+void report(Bench*, int);
+void switchTarget(Probe*, int);
+void benchAsync(Bench*, int);
+void benchContended(Bench*, int);
+void benchAbort(Bench*, int);
+void benchTimer(Bench*, int);
+void benchIrq(Bench*, int);
+void benchNested(Bench*, int);
+void nop(Probe*, int);
+void hold(Probe*, int);
+void entered(Probe*, int);
+int deviceInterrupt(Probe*, int);
+int outerInterrupt(Probe*, int);
+int innerInterrupt(Probe*, int);
+
+Serial sci0 = initSerial(SCI_PORT0, NULL, NULL);
+
+#define CYCLES() (DWT->CYCCNT)
+
+static void cyclesInit(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static void sample(Stat *s, unsigned int cycles) {
+    s->sum += cycles;
+    if (cycles > s->max)
+        s->max = cycles;
+    s->n++;
+}
+
+static unsigned int rnd(Bench *self) {
+    self->seed = self->seed * 1103515245 + 12345;
+    return (self->seed >> 16) & 0x7fff;
+}
+
+// Deadlines far beyond the deadline of benchQueue, so that nothing preempts
+// it while the ready queue is being filled.
+static Time sinkDeadline(Bench *self) {
+    return SEC(1) + USEC(10 * rnd(self));
+}
+
+void benchQueue(Bench *self, int step) {
+    int depth = depths[step];
+    Msg extra[N_SAMPLES];
+    int i;
+
+    for (i = 0; i < depth; i++)
+        BEFORE(sinkDeadline(self), self, sink, 0);
+
+    for (i = 0; i < N_SAMPLES; i++) {
+        Time dl = sinkDeadline(self);
+        unsigned int t0 = CYCLES();
+        extra[i] = BEFORE(dl, self, sink, 0);
+        sample(&self->insert[step], CYCLES() - t0);
+    }
+    for (i = 0; i < N_SAMPLES; i++)
+        ABORT(extra[i]);
+
+    self->step = step;
+    self->pending = depth;
+    self->lastExit = CYCLES();
+}
+
+void sink(Bench *self, int unused) {
+    unsigned int entry = CYCLES();
+    int step = self->step;
+    int depth = depths[step];
+
+    if (depth - self->pending < N_SAMPLES)
+        sample(&self->dequeue[step], entry - self->lastExit);
+
+    if (--self->pending == 0) {
+        if (step + 1 < N_DEPTHS)
+            BEFORE(MSEC(1), self, benchQueue, step + 1);
+        else
+            BEFORE(MSEC(1), self, benchSwitch, 0);
+    }
+    self->lastExit = CYCLES();
+}
+
+void switchTarget(Probe *self, int fp) {
+    sample(&bench.preempt[fp], CYCLES() - bench.t0);
+}
+
+// The probe has an earlier deadline than benchSwitch, so every BEFORE()
+// switches to a new thread and back.
+void benchSwitch(Bench *self, int unused) {
+    int i, fp;
+    for (fp = 0; fp < 2; fp++) {
+        for (i = 0; i < N_SAMPLES; i++) {
+            if (fp)
+                self->f = self->f * 1.5f;
+            self->t0 = CYCLES();
+            BEFORE(USEC(100), &probe, switchTarget, fp);
+        }
+    }
+    BEFORE(MSEC(1), self, benchAsync, 0);
+}
+
+void nop(Probe *self, int unused) {
+}
+
+// Called with a deadline far beyond that of benchAsync, ASYNC never
+// preempts; the empty methods run after benchAsync has returned.
+void benchAsync(Bench *self, int unused) {
+    int i;
+    unsigned int t0;
+    for (i = 0; i < N_SAMPLES; i++) {
+        t0 = CYCLES();
+        ASYNC(&probe, nop, 0);
+        sample(&self->asyncIdle, CYCLES() - t0);
+    }
+    for (i = 0; i < N_SAMPLES; i++) {
+        t0 = CYCLES();
+        BEFORE(USEC(100), &probe, nop, 0);
+        sample(&self->asyncPreempt, CYCLES() - t0);
+    }
+    for (i = 0; i < N_SAMPLES; i++) {
+        t0 = CYCLES();
+        SYNC(&probe, nop, 0);
+        sample(&self->syncFree, CYCLES() - t0);
+    }
+    BEFORE(MSEC(10), &resource, hold, 0);
+}
+
+// Runs with resource locked and lets benchContended preempt it, which then
+// blocks in SYNC until hold has returned.
+void hold(Probe *self, int i) {
+    BEFORE(USEC(100), &bench, benchContended, i);
+}
+
+void benchContended(Bench *self, int i) {
+    unsigned int t0 = CYCLES();
+    SYNC(&resource, nop, 0);
+    sample(&self->syncContended, CYCLES() - t0);
+    if (i + 1 < N_SAMPLES)
+        BEFORE(MSEC(10), &resource, hold, i + 1);
+    else
+        BEFORE(MSEC(1), self, benchAbort, 0);
+}
+
+// Steps 0 to N_DEPTHS-1 abort ready messages, the next N_DEPTHS timed ones.
+// The queue is emptied again before the next step.
+void benchAbort(Bench *self, int step) {
+    int timed = step >= N_DEPTHS;
+    int depth = depths[step % N_DEPTHS];
+    Stat *s = timed ? &self->abortTimed[step % N_DEPTHS] : &self->abortReady[step];
+    int i;
+
+    for (i = 0; i < depth; i++)
+        fill[i] = timed ? SEND(sinkDeadline(self), USEC(100), &probe, nop, 0)
+                        : BEFORE(sinkDeadline(self), &probe, nop, 0);
+    for (i = 0; i < N_SAMPLES; i++) {
+        Time t = sinkDeadline(self);
+        Msg m = timed ? SEND(t, USEC(100), &probe, nop, 0) : BEFORE(t, &probe, nop, 0);
+        unsigned int t0 = CYCLES();
+        ABORT(m);
+        sample(s, CYCLES() - t0);
+    }
+    for (i = 0; i < depth; i++)
+        ABORT(fill[i]);
+
+    if (step + 1 < 2 * N_DEPTHS)
+        BEFORE(MSEC(1), self, benchAbort, step + 1);
+    else
+        BEFORE(SEC(1), self, benchTimer, 0);
+}
+
+void entered(Probe *self, int unused) {
+    bench.entry = CYCLES();
+    bench.released = 1;
+}
+
+// With its long deadline, benchTimer is preempted by the released method.
+// The compare match happens between the last cycle count taken before the
+// counter reached the baseline of that method and the next one. The chain
+// of methods keeps the baseline of startup, so the release is placed 1 ms
+// after the present, not after the baseline, which is long past.
+void benchTimer(Bench *self, int i) {
+    Time offset = CURRENT_OFFSET() + MSEC(1);
+    Time release = (Time) BASELINE64() + offset;
+    unsigned int before = CYCLES();
+
+    self->released = 0;
+    SEND(offset, USEC(100), &probe, entered, 0);
+    while (!self->released) {
+        unsigned int now = CYCLES();
+        if ((Time) (TIM_GetCounter(TIM5) - release) < 0)
+            before = now;
+    }
+    sample(&self->timerRelease, self->entry - before);
+
+    if (i + 1 < N_SAMPLES)
+        BEFORE(SEC(1), self, benchTimer, i + 1);
+    else
+        BEFORE(SEC(1), self, benchIrq, 0);
+}
+
+// Installed handler: time its entry and send a method that preempts
+int deviceInterrupt(Probe *self, int unused) {
+    bench.irqEntry = CYCLES();
+    bench.released = 0;
+    if (TRY_SEND(0, USEC(100), &probe, entered, 0))
+        doIRQSchedule = 1;
+    return 0;
+}
+
+void benchIrq(Bench *self, int unused) {
+    int i;
+    for (i = 0; i < N_SAMPLES; i++) {
+        unsigned int t0 = CYCLES();
+        NVIC_SetPendingIRQ(EXTI9_5_IRQn);
+        while (!self->released)
+            ;
+        sample(&self->irqHandler, self->irqEntry - t0);
+        sample(&self->irqMethod, self->entry - t0);
+    }
+    BEFORE(MSEC(1), self, benchNested, 0);
+}
+
+static void spin(unsigned int cycles) {
+    unsigned int t0 = CYCLES();
+    while (CYCLES() - t0 < cycles)
+        ;
+}
+
+int outerInterrupt(Probe *self, int unused) {
+    spin(SPIN);
+    NVIC_SetPendingIRQ(EXTI1_IRQn);     // taken at once
+    spin(SPIN);
+    return 0;
+}
+
+int innerInterrupt(Probe *self, int unused) {
+    spin(SPIN);
+    bench.released = 1;
+    return 0;
+}
+
+// The statistics of both handlers are read back from the profiler
+void benchNested(Bench *self, int unused) {
+    static ProfileStats s[__PROFILE_ENTRIES];   // too large for a thread stack
+    int i, n;
+
+    PROFILE_RESET();
+    for (i = 0; i < N_SAMPLES; i++) {
+        self->released = 0;
+        NVIC_SetPendingIRQ(EXTI0_IRQn);
+        while (!self->released)
+            ;
+    }
+    n = PROFILE_STATS(s, __PROFILE_ENTRIES);
+    for (i = 0; i < n; i++)
+        if (s[i].method == (Method) outerInterrupt)
+            self->profOuter = s[i];
+        else if (s[i].method == (Method) innerInterrupt)
+            self->profInner = s[i];
+    ASYNC(self, report, 0);
+}
+
+static void printProfile(char *test, int param, ProfileStats *s) {
+    char line[64];
+    snprintf(line, sizeof line, "%s,%d,%u,%u\n", test, param,
+             s->count ? (unsigned int) (s->sum / s->count) : 0, (unsigned int) s->max);
+    SCI_WRITE(&sci0, line);
+}
+
+static void printStat(char *test, int param, Stat *s) {
+    char line[64];
+    snprintf(line, sizeof line, "%s,%d,%u,%u\n", test, param,
+             s->n ? s->sum / s->n : 0, s->max);
+    SCI_WRITE(&sci0, line);
+}
+
+void report(Bench *self, int unused) {
+    int i;
+    SCI_WRITE(&sci0, "test,param,mean_cycles,max_cycles\n");
+    for (i = 0; i < N_DEPTHS; i++)
+        printStat("readyq_insert", depths[i], &self->insert[i]);
+    for (i = 0; i < N_DEPTHS; i++)
+        printStat("readyq_dequeue", depths[i], &self->dequeue[i]);
+    for (i = 0; i < 2; i++)
+        printStat("switch_preempt", i, &self->preempt[i]);
+    printStat("async_idle", 0, &self->asyncIdle);
+    printStat("async_preempt", 0, &self->asyncPreempt);
+    printStat("sync_free", 0, &self->syncFree);
+    printStat("sync_contended", 0, &self->syncContended);
+    for (i = 0; i < N_DEPTHS; i++)
+        printStat("abort_ready", depths[i], &self->abortReady[i]);
+    for (i = 0; i < N_DEPTHS; i++)
+        printStat("abort_timed", depths[i], &self->abortTimed[i]);
+    printStat("timer_release", 0, &self->timerRelease);
+    printStat("irq_handler", 0, &self->irqHandler);
+    printStat("irq_method", 0, &self->irqMethod);
+    printProfile("prof_outer", SPIN, &self->profOuter);
+    printProfile("prof_inner", SPIN, &self->profInner);
+}
+
+void benchStart(Bench *self, int unused) {
+    SCI_INIT(&sci0);
+    SCI_WRITE(&sci0, "Kernel benchmark\n");
+    cyclesInit();
+    NVIC_EnableIRQ(EXTI9_5_IRQn);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+    NVIC_EnableIRQ(EXTI1_IRQn);
+    BEFORE(MSEC(1), self, benchQueue, 0);
+}
+
+int main() {
+    INSTALL(&sci0, sci_interrupt, SCI_IRQ0);
+    INSTALL(&device, deviceInterrupt, IRQ_EXTI9_5);
+    INSTALL_BEFORE(MSEC(5), &outer, outerInterrupt, EXTI0_IRQn);
+    INSTALL_BEFORE(USEC(50), &inner, innerInterrupt, EXTI1_IRQn);
+    TINYTIMBER(&bench, benchStart, 0);
+    return 0;
+}
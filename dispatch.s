@@ -1,135 +1,197 @@
-@
-@	dispatch.s
-@
-	.syntax unified
-	.cpu cortex-m4
-	.fpu fpv4-sp-d16
-	.thumb
- @	IMPORTS 
- 	.global	DUMP
-	.global	DUMPD
-	.global	DUMPH
-	.global current
-	.global upcoming
- @	EXPORTS
-	.global vect_SVCall
-	.global vect_PendSV
-  
-
-@	void vect_SVCall ( void)
-    .section  .text,"ax",%progbits
-	.type  vect_SVCall, %function
-
-vect_SVCall:
-	ldr	r1, =L00
-	b vect_PendSV1
-
-@
-@	void vect_PendSV ( void)
-    .section  .text,"ax",%progbits
-	.type  vect_PendSV, %function
-
-vect_PendSV:
-	ldr r1, =L01
-
-vect_PendSV1:
-	mrs r0, msp
-	vstmdb r0!, {s16-s31} @ save floating point registers
-	mov r2, lr
-	mrs r3, basepri
-	stmdb r0!, {r2-r11} @ save LR, BASEPRI and R4 to R11
-
-	ldr r7, =current
-	ldr	r8, [r7]
-	str r0, [r8] @ save thread context
-	
-	b L000a
-	
-@ Debug printout
-	mov r0, r1
-	bl		DUMP
-	ldr	r0, =L99
-	bl		DUMP
-
-	ldr	r0, =L03a
-	bl		DUMP
-	ldr	r0, [r8, #4] @ Thread ID
-	bl		DUMPD
-	ldr	r0, =L03b
-	bl		DUMP
-	ldr	r0, [r8] @ Thread context
-	bl		DUMPH
-	ldr	r0, =L03c
-	bl		DUMP
-	ldr	r0, [r8] 
-	ldr	r0, [r0] @ EXC_RETURN value
-	bl		DUMPH
-	ldr	r0, =L99
-	bl		DUMP
-
-L000a:
-	ldr	r8, =upcoming
-	ldr	r8, [r8]
-	str r8, [r7] @ set current = upcoming
-
-	b L000b
-	
-	ldr	r0, =L04a
-	bl		DUMP
-	ldr	r0, [r8, #4] @ Thread ID
-	bl		DUMPD
-	ldr	r0, =L04b
-	bl		DUMP
-	ldr	r0, [r8] @ Thread context
-	bl		DUMPH
-	ldr	r0, =L03c
-	bl		DUMP
-	ldr	r0, [r8] 
-	ldr	r0, [r0] @ EXC_RETURN value
-	bl		DUMPH
-	ldr	r0, =L99
-	bl		DUMP
-
-L000b:
-@ Clear Pend_SV exception	
-	ldr	r2,=0xE000ED00
-	ldr	r3, [r2, #4]	@ SCB->ICSR
-	orr	r3, r3, #(1<<27)	@ SCB_ICSR_PENDSVCLR_Msk
-	str	r3, [r2, #4]	@ SCB->ICSR
-	nop
-
-	ldr r0, [r8] @ save thread context
-	ldmia r0!, {r2-r11} @ load LR, BASEPRI and R4 to R11
-	msr basepri, r3
-	mov lr, r2
-	vldmia r0!, {s16-s31} @ load floating point registers
-	msr msp, r0
-	bx lr
-
-	.size  vect_PendSV, .-vect_PendSV
-	
-	.data
-	.align	2
-L00:
-	.ascii	"SVCall exception\000"
-L01:
-	.ascii	"PendSV exception\000"
-L02:
-	.ascii	", EXC_RETURN = \000"
-L03a:
-	.ascii	"  current thread: ID = \000"
-L03b:
-	.ascii	", SP = \000"
-L03c:
-	.ascii	", *SP = \000"
-L04a:
-	.ascii	"  next thread: ID = \000"
-L04b:
-	.ascii	", SP = \000"
-L04c:
-	.ascii	", *SP = \000"
-L99:
-	.ascii	"\n\r\000"
-
-	
-
+@
+@	dispatch.s
+@
+	.syntax unified
+	.cpu cortex-m4
+	.fpu fpv4-sp-d16
+	.thumb
+ @	IMPORTS 
+ 	.global	DUMP
+	.global	DUMPD
+	.global	DUMPH
+	.global current
+	.global upcoming
+	.global srp_run
+	.global pendsv_mail
+ @	EXPORTS
+	.global vect_SVCall
+	.global vect_PendSV
+	.global vect_SVCall_SRP
+	.global vect_PendSV_SRP
+  
+
+@	void vect_SVCall ( void)
+    .section  .text,"ax",%progbits
+	.type  vect_SVCall, %function
+
+vect_SVCall:
+	ldr	r1, =L00
+	b vect_PendSV1
+
+@
+@	void vect_PendSV ( void)
+    .section  .text,"ax",%progbits
+	.type  vect_PendSV, %function
+
+vect_PendSV:
+	ldr r2, =0xE000ED04 @ SCB->ICSR
+	mov r3, #(1<<27) @ SCB_ICSR_PENDSVCLR_Msk: a plain store, not read-modify-write,
+	str r3, [r2] @ so that a PendSV requested from here on is taken again
+	push {r0, lr} @ EXC_RETURN, and a pad word for alignment
+	bl pendsv_mail @ mailboxes, may change upcoming
+	pop {r0, lr}
+	ldr r1, =L01
+
+vect_PendSV1:
+	mrs r3, basepri @ of the interrupted context, saved with it
+	mov r2, #0x10 @ __DISABLED_PRIORITY << 4: no handler runs during the switch
+	msr basepri, r2
+	mrs r0, msp
+	tst lr, #0x10 @ EXC_RETURN bit 4 clear: thread has floating point state
+	it eq
+	vstmdbeq r0!, {s16-s31} @ save floating point registers
+	mov r2, lr
+	stmdb r0!, {r2-r11} @ save LR, BASEPRI and R4 to R11
+
+	ldr r7, =current
+	ldr	r8, [r7]
+	str r0, [r8] @ save thread context
+	
+	b L000a
+	
+@ Debug printout
+	mov r0, r1
+	bl		DUMP
+	ldr	r0, =L99
+	bl		DUMP
+
+	ldr	r0, =L03a
+	bl		DUMP
+	ldr	r0, [r8, #4] @ Thread ID
+	bl		DUMPD
+	ldr	r0, =L03b
+	bl		DUMP
+	ldr	r0, [r8] @ Thread context
+	bl		DUMPH
+	ldr	r0, =L03c
+	bl		DUMP
+	ldr	r0, [r8] 
+	ldr	r0, [r0] @ EXC_RETURN value
+	bl		DUMPH
+	ldr	r0, =L99
+	bl		DUMP
+
+L000a:
+	ldr	r8, =upcoming
+	ldr	r8, [r8]
+	str r8, [r7] @ set current = upcoming
+
+	b L000b
+	
+	ldr	r0, =L04a
+	bl		DUMP
+	ldr	r0, [r8, #4] @ Thread ID
+	bl		DUMPD
+	ldr	r0, =L04b
+	bl		DUMP
+	ldr	r0, [r8] @ Thread context
+	bl		DUMPH
+	ldr	r0, =L03c
+	bl		DUMP
+	ldr	r0, [r8] 
+	ldr	r0, [r0] @ EXC_RETURN value
+	bl		DUMPH
+	ldr	r0, =L99
+	bl		DUMP
+
+L000b:
+	ldr r0, [r8] @ save thread context
+	ldmia r0!, {r2-r11} @ load LR, BASEPRI and R4 to R11
+	mov lr, r2
+	tst lr, #0x10 @ EXC_RETURN bit 4 clear: thread has floating point state
+	it eq
+	vldmiaeq r0!, {s16-s31} @ load floating point registers
+	msr msp, r0
+	msr basepri, r3 @ the new thread's, once its stack is in place
+	bx lr
+
+	.size  vect_PendSV, .-vect_PendSV
+
+@
+@	void vect_PendSV_SRP ( void)
+@	Single stack mode (__USE_SRP): leave the interrupted context where it
+@	is and return to thread mode through a fake exception frame that starts
+@	srp_entry on top of it.
+    .section  .text,"ax",%progbits
+	.type  vect_PendSV_SRP, %function
+
+vect_PendSV_SRP:
+	tst lr, #0x10 @ EXC_RETURN bit 4 clear: thread has floating point state
+	it eq
+	vmoveq.f32 s0, s0 @ force the lazy stacking of S0-S15 and FPSCR
+	mrs r0, msp
+	stmdb r0!, {r1, lr} @ save EXC_RETURN (and a pad word)
+	sub r0, r0, #32 @ basic exception frame
+	ldr r1, =srp_entry
+	bic r1, r1, #1
+	str r1, [r0, #24] @ PC
+	mov r1, #0x01000000
+	str r1, [r0, #28] @ xPSR, Thumb state
+	msr msp, r0
+	ldr lr, =0xFFFFFFF9 @ thread mode, MSP, no FP state
+	bx lr
+
+	.size  vect_PendSV_SRP, .-vect_PendSV_SRP
+
+@	Thread mode, interrupts as in the interrupted context
+	.type  srp_entry, %function
+
+srp_entry:
+	bl srp_run
+	mrs r0, control
+	bic r0, r0, #4 @ clear FPCA, so that the SVC frame is a basic one
+	msr control, r0
+	isb
+	svc 0x11
+
+@
+@	void vect_SVCall_SRP ( void)
+@	Drop the frame of the svc in srp_entry and resume the context that was
+@	interrupted when vect_PendSV_SRP ran.
+    .section  .text,"ax",%progbits
+	.type  vect_SVCall_SRP, %function
+
+vect_SVCall_SRP:
+	mrs r0, msp
+	add r0, r0, #32 @ basic exception frame
+	ldmia r0!, {r1, r2} @ pad word and EXC_RETURN
+	msr msp, r0
+	bx r2
+
+	.size  vect_SVCall_SRP, .-vect_SVCall_SRP
+	
+	.data
+	.align	2
+L00:
+	.ascii	"SVCall exception\000"
+L01:
+	.ascii	"PendSV exception\000"
+L02:
+	.ascii	", EXC_RETURN = \000"
+L03a:
+	.ascii	"  current thread: ID = \000"
+L03b:
+	.ascii	", SP = \000"
+L03c:
+	.ascii	", *SP = \000"
+L04a:
+	.ascii	"  next thread: ID = \000"
+L04b:
+	.ascii	", SP = \000"
+L04c:
+	.ascii	", *SP = \000"
+L99:
+	.ascii	"\n\r\000"
+
+	
+
@@ -0,0 +1,893 @@
+/*
+ *
+ * hostTinyTimber.c
+ *
+ * Host (Linux/POSIX) port of the TinyTimber kernel, built with 'make host'.
+ * This file takes the place of dispatch.s, startup.c and the peripherals
+ * of the MD407 board:
+ *
+ *  - threads are ucontext contexts, switched by vect_PendSV/vect_SVCall;
+ *  - interrupts are signals, masked with sigprocmask by sei()/cli(), and
+ *    interrupt handlers are called from a signal handler through the
+ *    vector table hostVectors[];
+ *  - TIM5 is CLOCK_MONOTONIC, its compare channel a POSIX timer (SIGALRM);
+ *  - USART1 is stdin/stdout (SIGIO on input), with the terminal in raw mode;
+ *  - CAN1 is always in loopback, a frame sent is received on FIFO0;
+ *  - the user button (GPIOB pin 7, EXTI line 7) is toggled by SIGUSR2,
+ *    e.g. 'kill -USR2 <pid>'.
+ *
+ * The program must be 32-bit (-m32), since method arguments are ints that
+ * may carry pointers. Peripheral and core registers that are only written
+ * (NVIC, DAC) are backed by anonymous memory mapped at their addresses.
+ *
+ * With __SIM ('make sim') the program is a discrete event simulation
+ * instead: there are no signals, and TIM5 is a virtual clock that jumps
+ * to the next compare match or input event whenever the system is idle.
+ * Methods take the execution time set with SIM_COST, during which they
+ * can be preempted. Input comes from a script, read from the file named
+ * by SIM_SCRIPT or from stdin, with one event per line:
+ *
+ *      <ms> sci <text>                 characters (escapes \n \r \t \\)
+ *      <ms> can <msgId> <nodeId> [<byte> ...]
+ *      <ms> button                     user button toggles
+ *      <ms> end                        end of the simulation
+ *
+ * Times are virtual milliseconds from startup, in increasing order; '#'
+ * starts a comment. The simulation also ends when nothing is left to
+ * happen. Serial output goes to stdout, with lines prefixed by the
+ * virtual time if SIM_STAMP is set. A given program and script always
+ * give the same schedule and output.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#define sync posix_sync     // the kernel has a sync() of its own
+#include <unistd.h>
+#undef sync
+
+#include "TinyTimber.h"
+#include "hostTinyTimber.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_usart.h"
+#include "stm32f4xx_can.h"
+#include "stm32f4xx_exti.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+
+#define NS_PER_TICK     (1000000000LL / __TICKS_PER_SEC)
+
+#define VECTOR(irq)     (16 + (irq))
+
+struct host_context {
+    ucontext_t uc;
+    int masked;
+    int handler;
+};
+
+void (*hostVectors[HOST_VECTORS])( void);
+volatile char hostPending[HOST_VECTORS];
+int hostActive      = 0;
+
+int hostMasked      = 0;
+int hostHandler     = 0;
+
+static struct host_context hostMain;        // context of thread0
+static int64_t hostDue[4];                  // compare match of each channel (ticks)
+static int hostArmed    = 0;                // channels armed, one bit each
+#ifdef	__SIM
+static int64_t simNow   = 0;                // virtual time (ns)
+static int simStamp     = 0;                // prefix output lines with simNow
+
+static void simTake( void);
+static void simIdle( void);
+static int64_t hostNextMatch( void);
+#else
+static sigset_t hostSignals;                // the signals that stand in for interrupts
+static struct timespec hostEpoch;           // TIM5 counter 0
+static timer_t hostTimer;
+static struct termios hostTerminal;
+static int hostRaw  = 0;
+#endif
+
+extern unsigned int overflows;
+
+void DUMP(char *s);
+
+
+/* interrupt masking */
+
+#ifdef	__SIM
+
+// Interrupts are taken synchronously, when requested or unmasked
+void sei( void) {
+    hostMasked = 1;
+}
+
+void cli( void) {
+    hostMasked = 0;
+    if (!hostHandler)
+        simTake();
+}
+
+void hostSleep( void) {
+    simIdle();
+}
+
+static void hostKick( void) {
+    if (!hostHandler && !hostMasked)
+        simTake();
+}
+
+#else
+
+void sei( void) {
+    if (!hostHandler && !hostMasked)
+        sigprocmask(SIG_BLOCK, &hostSignals, NULL);
+    hostMasked = 1;
+}
+
+void cli( void) {
+    hostMasked = 0;
+    if (!hostHandler)
+        sigprocmask(SIG_UNBLOCK, &hostSignals, NULL);
+}
+
+void hostSleep( void) {
+    sigset_t none;
+    sigemptyset(&none);
+    sigsuspend(&none);
+}
+
+// Interrupt requests made in thread mode are taken by the signal handler,
+// at once or when interrupts are enabled again.
+static void hostKick( void) {
+    if (!hostHandler)
+        raise(SIGUSR1);
+}
+
+#endif
+
+void hostPend( int irq) {
+    hostPending[VECTOR(irq)] = 1;
+    hostKick();
+}
+
+
+/* context switching */
+
+void SETSTACK(CONTEXT_T *cp, struct stack *sp) {
+    struct host_context *c = calloc(1, sizeof(struct host_context));
+    getcontext(&c->uc);
+    c->uc.uc_stack.ss_sp = sp;
+    c->uc.uc_stack.ss_size = STACKSIZE * sizeof(STACK_T);
+    c->uc.uc_link = NULL;
+    sigprocmask(SIG_BLOCK, NULL, &c->uc.uc_sigmask);
+    sigaddset(&c->uc.uc_sigmask, SIGALRM);      // start in thread mode, disabled
+    sigaddset(&c->uc.uc_sigmask, SIGIO);
+    sigaddset(&c->uc.uc_sigmask, SIGUSR1);
+    sigaddset(&c->uc.uc_sigmask, SIGUSR2);
+    c->masked = 1;
+    c->handler = 0;
+    *cp = c;
+}
+
+void SETPC(CONTEXT_T *cp, void (*fp)(void)) {
+    makecontext(&(*cp)->uc, fp, 0);
+}
+
+// The signal mask is part of the ucontext, the interrupt state is not.
+void hostSwitch(CONTEXT_T *from, CONTEXT_T *to) {
+    if (*from == NULL)
+        *from = &hostMain;
+    (*from)->masked = hostMasked;
+    (*from)->handler = hostHandler;
+    hostMasked = (*to)->masked;
+    hostHandler = (*to)->handler;
+    swapcontext(&(*from)->uc, &(*to)->uc);
+}
+
+
+/* devices */
+
+#define RX_BUFSIZE      256
+
+static char rxBuf[RX_BUFSIZE];
+static int rxHead = 0, rxTail = 0, rxCount = 0;
+static int usartRxIE = 0, usartTxIE = 0;
+
+#define CAN_FIFOSIZE    3
+
+static CanRxMsg canFifo[CAN_FIFOSIZE];
+static int canHead = 0, canCount = 0;
+static int canFmpIE = 0;
+
+static uint16_t gpioOut[9], gpioIn[9];
+
+#define GPIO_INDEX(port)    (((uintptr_t) (port) - GPIOA_BASE) / 0x400)
+
+static uint32_t extiIMR = 0, extiRising = 0, extiFalling = 0, extiPR = 0;
+
+static void hostReceive(char c) {
+    if (rxCount < RX_BUFSIZE) {             // else overrun, c is lost
+        rxBuf[rxHead] = c;
+        rxHead = (rxHead + 1) % RX_BUFSIZE;
+        rxCount++;
+    }
+}
+
+#ifndef	__SIM
+// Read whatever stdin has, as the USART receiver would
+static void hostInput( void) {
+    char c;
+    while (rxCount < RX_BUFSIZE && read(0, &c, 1) == 1)
+        hostReceive(c);
+}
+#endif
+
+// The user button toggles, EXTI sees an edge
+static void hostButton( void) {
+    int level;
+    gpioIn[GPIO_INDEX(GPIOB)] ^= GPIO_Pin_7;
+    level = (gpioIn[GPIO_INDEX(GPIOB)] & GPIO_Pin_7) != 0;
+    if ((level && (extiRising & EXTI_Line7)) || (!level && (extiFalling & EXTI_Line7)))
+        extiPR |= EXTI_Line7;
+}
+
+// NVIC_EnableIRQ writes to ISER (write one to set), which memory can not
+// keep track of; a device interrupt counts as enabled once installed.
+static int enabled(IRQn_Type irq) {
+    return hostVectors[VECTOR(irq)] != NULL;
+}
+
+// Device interrupt requests are levels, sampled after every handler
+static void hostPoll( void) {
+    int w;
+#ifdef	__SIM
+    if (hostArmed && hostNextMatch() * NS_PER_TICK <= simNow)
+        hostPending[VECTOR(TIM5_IRQn)] = 1;
+#endif
+    if (enabled(USART1_IRQn) && ((rxCount && usartRxIE) || usartTxIE))
+        hostPending[VECTOR(USART1_IRQn)] = 1;
+    if (enabled(CAN1_RX0_IRQn) && canCount && canFmpIE)
+        hostPending[VECTOR(CAN1_RX0_IRQn)] = 1;
+    if (enabled(EXTI9_5_IRQn) && (extiPR & extiIMR & 0x3E0))
+        hostPending[VECTOR(EXTI9_5_IRQn)] = 1;
+    // Lines set pending with NVIC_SetPendingIRQ, e.g. DMA or timer IRQs
+    // of the application, are noticed here, at the next interrupt
+    for (w = 0; w < 3; w++)
+        while (NVIC->ISPR[w]) {
+            int bit = __builtin_ctz(NVIC->ISPR[w]);
+            NVIC->ISPR[w] &= ~(1u << bit);
+            if (enabled((IRQn_Type) (32*w + bit)))
+                hostPending[VECTOR(32*w + bit)] = 1;
+        }
+}
+
+// The exception entry: run the pending handlers, lowest vector first and
+// PendSV last, as tail-chained exceptions of equal priority would.
+static void hostInterrupt(int sig) {
+    int masked = hostMasked;
+    int i, more;
+
+    hostHandler = 1;
+    hostMasked = 0;
+    switch (sig) {
+#ifndef	__SIM
+      case SIGALRM:
+        hostPending[VECTOR(TIM5_IRQn)] = 1;
+        break;
+      case SIGIO:
+        hostInput();
+        break;
+      case SIGUSR2:
+        hostButton();
+        break;
+#endif
+    }
+    do {
+        more = 0;
+        hostPoll();
+        for (i = VECTOR(0); i < HOST_VECTORS; i++)
+            if (hostPending[i]) {
+                hostPending[i] = 0;
+                if (hostVectors[i]) {
+                    int active = hostActive;
+                    hostActive = i;
+                    hostVectors[i]();
+                    hostActive = active;
+                }
+                more = 1;
+                break;
+            }
+    } while (more);
+    if (hostPending[VECTOR(PendSV_IRQn)]) {
+        hostPending[VECTOR(PendSV_IRQn)] = 0;
+        hostVectors[VECTOR(PendSV_IRQn)]();
+    }
+    hostHandler = 0;
+    hostMasked = masked;
+}
+
+void USART_SendData(USART_TypeDef* USARTx, uint16_t Data) {
+#ifdef	__SIM
+    static int newLine = 1;
+    if (simStamp && newLine)
+        printf("[%4lld.%06lld] ", (long long) (simNow / 1000000000LL), (long long) (simNow / 1000 % 1000000));
+    putchar(Data);
+    newLine = (Data == '\n');
+#else
+    char c = Data;
+    if (write(1, &c, 1) < 0)
+        return;
+#endif
+}
+
+uint16_t USART_ReceiveData(USART_TypeDef* USARTx) {
+    char c = 0;
+    if (rxCount) {
+        c = rxBuf[rxTail];
+        rxTail = (rxTail + 1) % RX_BUFSIZE;
+        rxCount--;
+    }
+    return c;
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef* USARTx, uint16_t USART_FLAG) {
+    switch (USART_FLAG) {
+      case USART_FLAG_TXE:
+      case USART_FLAG_TC:
+        return SET;
+      case USART_FLAG_RXNE:
+        return rxCount ? SET : RESET;
+    }
+    return RESET;
+}
+
+void USART_ITConfig(USART_TypeDef* USARTx, uint16_t USART_IT, FunctionalState NewState) {
+    if (USART_IT == USART_IT_RXNE)
+        usartRxIE = NewState;
+    else if (USART_IT == USART_IT_TXE)
+        usartTxIE = NewState;
+    hostKick();
+}
+
+void CAN_StructInit(CAN_InitTypeDef* CAN_InitStruct) {
+    memset(CAN_InitStruct, 0, sizeof(CAN_InitTypeDef));
+    CAN_InitStruct->CAN_Prescaler = 1;
+}
+
+uint8_t CAN_Init(CAN_TypeDef* CANx, CAN_InitTypeDef* CAN_InitStruct) {
+    return CAN_InitStatus_Success;
+}
+
+void CAN_ITConfig(CAN_TypeDef* CANx, uint32_t CAN_IT, FunctionalState NewState) {
+    if (CANx == CAN1 && CAN_IT == CAN_IT_FMP0)
+        canFmpIE = NewState;
+    hostKick();
+}
+
+FlagStatus CAN_GetFlagStatus(CAN_TypeDef* CANx, uint32_t CAN_FLAG) {
+    if (CANx == CAN1 && CAN_FLAG == CAN_FLAG_FMP0)
+        return canCount ? SET : RESET;
+    return RESET;
+}
+
+void CAN_Receive(CAN_TypeDef* CANx, uint8_t FIFONumber, CanRxMsg* RxMessage) {
+    if (CANx == CAN1 && FIFONumber == CAN_FIFO0 && canCount) {
+        *RxMessage = canFifo[canHead];
+        canHead = (canHead + 1) % CAN_FIFOSIZE;
+        canCount--;
+    }
+}
+
+// A frame arrives in FIFO0 of CAN1 (lost if the FIFO is full)
+static CanRxMsg *hostFrame( void) {
+    CanRxMsg *rx;
+    if (canCount == CAN_FIFOSIZE)
+        return NULL;
+    rx = &canFifo[(canHead + canCount) % CAN_FIFOSIZE];
+    memset(rx, 0, sizeof(CanRxMsg));
+    canCount++;
+    return rx;
+}
+
+// Loopback: the frame goes to FIFO0 of CAN1
+uint8_t CAN_Transmit(CAN_TypeDef* CANx, CanTxMsg* TxMessage) {
+    int wasMasked = hostMasked;
+    CanRxMsg *rx;
+    sei();
+    rx = hostFrame();
+    if (rx) {
+        rx->StdId = TxMessage->StdId;
+        rx->ExtId = TxMessage->ExtId;
+        rx->IDE = TxMessage->IDE;
+        rx->RTR = TxMessage->RTR;
+        rx->DLC = TxMessage->DLC;
+        memcpy(rx->Data, TxMessage->Data, sizeof(rx->Data));
+    }
+    if (!wasMasked)
+        cli();
+    hostKick();
+    return 0;
+}
+
+uint8_t CAN_TransmitStatus(CAN_TypeDef* CANx, uint8_t TransmitMailbox) {
+    return CAN_TxStatus_Ok;
+}
+
+void GPIO_WriteBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, BitAction BitVal) {
+    if (BitVal)
+        gpioOut[GPIO_INDEX(GPIOx)] |= GPIO_Pin;
+    else
+        gpioOut[GPIO_INDEX(GPIOx)] &= ~GPIO_Pin;
+}
+
+void GPIO_ToggleBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+    gpioOut[GPIO_INDEX(GPIOx)] ^= GPIO_Pin;
+}
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+    return (gpioIn[GPIO_INDEX(GPIOx)] & GPIO_Pin) ? Bit_SET : Bit_RESET;
+}
+
+void EXTI_StructInit(EXTI_InitTypeDef* EXTI_InitStruct) {
+    EXTI_InitStruct->EXTI_Line = 0;
+    EXTI_InitStruct->EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStruct->EXTI_Trigger = EXTI_Trigger_Falling;
+    EXTI_InitStruct->EXTI_LineCmd = DISABLE;
+}
+
+void EXTI_Init(EXTI_InitTypeDef* EXTI_InitStruct) {
+    uint32_t line = EXTI_InitStruct->EXTI_Line;
+    extiRising &= ~line;
+    extiFalling &= ~line;
+    if (EXTI_InitStruct->EXTI_LineCmd == DISABLE) {
+        extiIMR &= ~line;
+        return;
+    }
+    extiIMR |= line;
+    if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Falling)
+        extiRising |= line;
+    if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Rising)
+        extiFalling |= line;
+}
+
+ITStatus EXTI_GetITStatus(uint32_t EXTI_Line) {
+    return (extiPR & extiIMR & EXTI_Line) ? SET : RESET;
+}
+
+void EXTI_ClearITPendingBit(uint32_t EXTI_Line) {
+    extiPR &= ~EXTI_Line;
+}
+
+void DUMPC(char c) {
+    if (write(2, &c, 1) < 0)
+        return;
+}
+
+
+/* timer */
+
+static int64_t hostTicks( void);
+static void hostTimerProgram( void);
+
+// The counter is 32 bits, as TIM5; its wraps are counted as the update
+// interrupt would.
+int32_t hostTimerGet( void) {
+    int64_t ticks = hostTicks();
+    overflows = ticks >> 32;
+    return (int32_t) ticks;
+}
+
+// Compare match on channel c at the next time the counter equals t; one
+// that has already passed fires at once (the target would wait for a wrap,
+// see __USE_FUTURE_CHECK_TIMER).
+void hostTimerSet( int c, int32_t t) {
+    int64_t now = hostTicks();
+    hostDue[c] = now + (int32_t) (t - (int32_t) now);
+    hostArmed |= 1 << c;
+    hostTimerProgram();
+}
+
+int hostCompared( int c) {
+    return (hostArmed & (1 << c)) && hostDue[c] <= hostTicks();
+}
+
+// As on the target, clearing the flag of a match leaves the channel armed:
+// it matches again when the counter comes round, unless it is set again or
+// disarmed.
+void hostTimerClear( int c) {
+    if ((hostArmed & (1 << c)) && hostDue[c] <= hostTicks())
+        hostDue[c] += (int64_t) 1 << 32;
+    hostTimerProgram();
+}
+
+void hostTimerDisarm( int c) {
+    hostArmed &= ~(1 << c);
+    hostTimerProgram();
+}
+
+// Earliest compare match of the armed channels
+static int64_t hostNextMatch( void) {
+    int64_t t = INT64_MAX;
+    int c;
+    for (c = 0; c < 4; c++)
+        if ((hostArmed & (1 << c)) && hostDue[c] < t)
+            t = hostDue[c];
+    return t;
+}
+
+#ifdef	__SIM
+
+static int64_t hostTicks( void) {
+    return simNow / NS_PER_TICK;
+}
+
+static void hostTimerProgram( void) {
+}
+
+uint32_t hostCycles( void) {
+    return (uint32_t) simNow;
+}
+
+void TIMER_INIT( void) {
+    hostVectors[VECTOR(PendSV_IRQn)] = vect_PendSV;
+    hostVectors[VECTOR(SVCall_IRQn)] = vect_SVCall;
+    hostVectors[VECTOR(TIM5_IRQn)] = vect_TIM5;
+}
+
+#else
+
+static int64_t hostNow( void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - hostEpoch.tv_sec) * 1000000000LL + (ts.tv_nsec - hostEpoch.tv_nsec);
+}
+
+static int64_t hostTicks( void) {
+    return hostNow() / NS_PER_TICK;
+}
+
+// The POSIX timer expires at the earliest compare match
+static void hostTimerProgram( void) {
+    int64_t now = hostTicks();
+    int64_t due = hostNextMatch();
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof its);
+    if (due != INT64_MAX) {
+        if (due <= now)
+            due = now + 1;
+        due *= NS_PER_TICK;
+        its.it_value.tv_sec = hostEpoch.tv_sec + (hostEpoch.tv_nsec + due) / 1000000000LL;
+        its.it_value.tv_nsec = (hostEpoch.tv_nsec + due) % 1000000000LL;
+    }
+    timer_settime(hostTimer, TIMER_ABSTIME, &its, NULL);
+}
+
+uint32_t hostCycles( void) {
+    return (uint32_t) hostNow();
+}
+
+void TIMER_INIT( void) {
+    struct sigevent sev;
+
+    hostVectors[VECTOR(PendSV_IRQn)] = vect_PendSV;
+    hostVectors[VECTOR(SVCall_IRQn)] = vect_SVCall;
+    hostVectors[VECTOR(TIM5_IRQn)] = vect_TIM5;
+
+    memset(&sev, 0, sizeof sev);
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &hostTimer) < 0) {
+        perror("timer_create");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &hostEpoch);
+}
+
+#endif
+
+
+/* start up */
+
+void hostAlert( void) {
+    DUMP("RED ALERT\n\r");
+}
+
+#ifndef	__SIM
+static void hostRestore( void) {
+    if (hostRaw)
+        tcsetattr(0, TCSANOW, &hostTerminal);
+}
+#endif
+
+void hostExit( int status) {
+    exit(status);
+}
+
+static void map(uintptr_t addr, size_t size) {
+    if (mmap((void *) addr, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+}
+
+// Runs before main, as startup.c does on the target
+#ifdef	__SIM
+static void simLoad( void);
+#endif
+
+__attribute__((constructor)) static void hostStartup( void) {
+#ifndef	__SIM
+    struct sigaction sa;
+    struct termios raw;
+#endif
+
+    map(PERIPH_BASE, 0x80000);          // APB1/APB2 peripherals (DAC, ...)
+    map(SCS_BASE & 0xFFF00000, 0x100000);   // NVIC, SCB, DWT
+
+#ifdef	__SIM
+    simStamp = getenv("SIM_STAMP") != NULL;
+    simLoad();
+#else
+
+    sigemptyset(&hostSignals);
+    sigaddset(&hostSignals, SIGALRM);
+    sigaddset(&hostSignals, SIGIO);
+    sigaddset(&hostSignals, SIGUSR1);
+    sigaddset(&hostSignals, SIGUSR2);
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = hostInterrupt;
+    sa.sa_mask = hostSignals;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+    sigaction(SIGIO, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    if (tcgetattr(0, &hostTerminal) == 0) {
+        raw = hostTerminal;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(0, TCSANOW, &raw) == 0) {
+            hostRaw = 1;
+            atexit(hostRestore);
+        }
+    }
+    fcntl(0, F_SETOWN, getpid());
+    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK | O_ASYNC);
+
+    fprintf(stderr, "TinyTimber host port, pid %d (kill -USR2 toggles the user button)\n", getpid());
+#endif
+}
+
+
+#ifdef	__SIM
+
+/* simulation */
+
+enum { SIM_SCI, SIM_CAN, SIM_BUTTON, SIM_END };
+
+typedef struct {
+    int64_t at;                     // virtual time (ns)
+    int kind;
+    int len;
+    char data[64];                  // characters, or CAN payload
+    int msgId, nodeId;
+} SimEvent;
+
+#define SIM_COSTS       64
+
+static SimEvent *simScript = NULL;
+static int simEvents    = 0;
+static int simNext      = 0;        // next script event
+
+static struct {
+    Method meth;
+    int64_t ns;
+} simCosts[SIM_COSTS];
+static int simCostCount = 0;
+static int64_t simDefault = 0;      // cost of methods not in simCosts
+
+static void simFail(int line, char *what) {
+    fprintf(stderr, "simulation script, line %d: %s\n", line, what);
+    exit(1);
+}
+
+// Text up to the end of the line, with C escapes
+static int simText(char *p, char *buf, int size) {
+    int n = 0;
+    while (*p && *p != '\n' && n < size) {
+        char c = *p++;
+        if (c == '\\' && *p) {
+            c = *p++;
+            c = c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c;
+        }
+        buf[n++] = c;
+    }
+    return n;
+}
+
+static void simLoad( void) {
+    char *name = getenv("SIM_SCRIPT");
+    FILE *f = name ? fopen(name, "r") : stdin;
+    char line[256];
+    int lineNo = 0, size = 0;
+
+    if (!f) {
+        perror(name);
+        exit(1);
+    }
+    while (fgets(line, sizeof line, f)) {
+        SimEvent e;
+        char *p, kind[16];
+        double ms;
+        int n;
+
+        lineNo++;
+        if ((p = strchr(line, '#')))
+            *p = '\0';
+        if (sscanf(line, "%lf %15s %n", &ms, kind, &n) < 2)
+            continue;
+        memset(&e, 0, sizeof e);
+        e.at = (int64_t) (ms * 1000000.0 + 0.5);
+        p = line + n;
+        if (!strcmp(kind, "sci")) {
+            e.kind = SIM_SCI;
+            e.len = simText(p, e.data, sizeof e.data);
+        } else if (!strcmp(kind, "can")) {
+            e.kind = SIM_CAN;
+            e.msgId = strtol(p, &p, 0);
+            e.nodeId = strtol(p, &p, 0);
+            while (e.len < 8 && *p && *p != '\n')
+                e.data[e.len++] = strtol(p, &p, 0);
+        } else if (!strcmp(kind, "button"))
+            e.kind = SIM_BUTTON;
+        else if (!strcmp(kind, "end"))
+            e.kind = SIM_END;
+        else
+            simFail(lineNo, "unknown event");
+        if (simEvents && e.at < simScript[simEvents - 1].at)
+            simFail(lineNo, "time goes backwards");
+        if (simEvents == size) {
+            size = size ? 2 * size : 64;
+            simScript = realloc(simScript, size * sizeof(SimEvent));
+        }
+        simScript[simEvents++] = e;
+    }
+    if (name)
+        fclose(f);
+}
+
+static void simFinish( void) {
+    fflush(stdout);
+    fprintf(stderr, "\nsimulation ended at %lld.%06lld s\n",
+            (long long) (simNow / 1000000000LL), (long long) (simNow / 1000 % 1000000));
+    exit(0);
+}
+
+static void simInject(SimEvent *e) {
+    int i;
+    CanRxMsg *rx;
+
+    switch (e->kind) {
+      case SIM_SCI:
+        for (i = 0; i < e->len; i++)
+            hostReceive(e->data[i]);
+        break;
+      case SIM_CAN:
+        rx = hostFrame();
+        if (rx) {
+            rx->StdId = (e->msgId << 4) + e->nodeId;
+            rx->IDE = CAN_Id_Standard;
+            rx->RTR = CAN_RTR_Data;
+            rx->DLC = e->len;
+            memcpy(rx->Data, e->data, e->len);
+        }
+        break;
+      case SIM_BUTTON:
+        hostButton();
+        break;
+      case SIM_END:
+        simFinish();
+    }
+}
+
+// Time of the next event, INT64_MAX if there is none
+static int64_t simUpcoming( void) {
+    int64_t t = INT64_MAX;
+    if (simNext < simEvents)
+        t = simScript[simNext].at;
+    if (hostArmed && hostNextMatch() * NS_PER_TICK < t)
+        t = hostNextMatch() * NS_PER_TICK;
+    return t;
+}
+
+// Advance the clock to t, injecting the script events on the way
+static void simAdvance(int64_t t) {
+    while (simNext < simEvents && simScript[simNext].at <= t) {
+        if (simScript[simNext].at > simNow)
+            simNow = simScript[simNext].at;
+        simInject(&simScript[simNext++]);
+    }
+    if (t > simNow)
+        simNow = t;
+}
+
+// Take the interrupts requested so far
+static void simTake( void) {
+    int i;
+    hostPoll();
+    for (i = VECTOR(PendSV_IRQn); i < HOST_VECTORS; i++)
+        if (hostPending[i]) {
+            hostInterrupt(0);
+            return;
+        }
+}
+
+static void simIdle( void) {
+    int64_t t = simUpcoming();
+    if (t == INT64_MAX)
+        simFinish();                    // nothing left to happen
+    simAdvance(t);
+    simTake();
+}
+
+void sim_cost(Method meth, int cost) {
+    int i;
+    if (!meth) {
+        simDefault = cost;
+        return;
+    }
+    for (i = 0; i < simCostCount; i++)
+        if (simCosts[i].meth == meth)
+            break;
+    if (i == SIM_COSTS) {
+        DUMP("SIM_COST: too many methods\n\r");
+        return;
+    }
+    simCosts[i].meth = meth;
+    simCosts[i].ns = cost;
+    if (i == simCostCount)
+        simCostCount++;
+}
+
+// Called by the kernel when meth has returned: its execution time passes,
+// and interrupts that come due on the way preempt it unless masked.
+void simExecuted(Method meth) {
+    int64_t left = simDefault;
+    int i;
+
+    for (i = 0; i < simCostCount; i++)
+        if (simCosts[i].meth == meth)
+            left = simCosts[i].ns;
+    while (left > 0) {
+        int64_t t = simUpcoming();
+        if (hostHandler || hostMasked || t - simNow >= left) {
+            simAdvance(simNow + left);
+            return;
+        }
+        if (t > simNow) {
+            left -= t - simNow;
+            simAdvance(t);
+        } else
+            simAdvance(simNow);
+        simTake();
+    }
+}
+
+#endif
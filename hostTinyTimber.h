@@ -0,0 +1,112 @@
+/*
+ *
+ * hostTinyTimber.h
+ *
+ * Host (Linux/POSIX) dependencies of TinyTimber.c, used instead of the
+ * Cortex m4 dependencies when the kernel is built with __HOST. The
+ * implementation, including the stand-in devices, is in hostTinyTimber.c.
+ *
+ */
+
+#ifndef HOST_TINYT_H
+#define HOST_TINYT_H
+
+#include <stdint.h>
+
+#ifdef __USE_SRP
+#error "__USE_SRP relies on Cortex m4 exception frames and is not available on the host"
+#endif
+
+#undef __USE_SAFE_TIMER
+
+// Interrupts are signals, masked with sigprocmask. An interrupt handler
+// runs inside a signal handler, with all kernel signals blocked.
+
+extern int hostMasked;      // interrupts disabled (BASEPRI = __DISABLED_PRIORITY)
+extern int hostHandler;     // running in an interrupt handler (handler mode)
+
+void sei( void);
+void cli( void);
+void hostSleep( void);
+void hostAlert( void);
+void hostExit( int status);
+
+#define PROTECTED()     (hostMasked)
+#define THREADMODE()    (!hostHandler)
+#define SLEEP()         { hostSleep(); }
+#define RED_ALERT()     { hostAlert(); }
+#define PANIC(s)        { DUMP("PANIC!!! "); DUMP(s); DUMP("\n\r"); hostExit(1); }
+
+// Threads are ucontext contexts
+
+struct host_context;
+struct stack;
+
+#define CONTEXT_T       struct host_context *
+#define STACKSIZE       8192    // signal frames and the C library need more than the target
+#define STACK_T         long long
+#define SETCONTEXT(c)
+
+void SETSTACK( CONTEXT_T *cp, struct stack *sp);
+void SETPC( CONTEXT_T *cp, void (*fp)(void));
+void hostSwitch( CONTEXT_T *from, CONTEXT_T *to);
+
+// Vector table, indexed as on the target (16 + IRQn)
+
+#define HOST_VECTORS    128
+
+extern void (*hostVectors[HOST_VECTORS])( void);
+
+void hostPend( int irq);    // set IRQn (or PendSV_IRQn) pending
+
+#define VECTOR_ADDR(offset)     ((uintptr_t) &hostVectors[(offset) / 4])
+
+#define PendSV_Exception        void vect_PendSV( void )
+#define SVCall_Exception        void vect_SVCall( void )
+#define TIMER_COMPARE_INTERRUPT void vect_TIM5( void )
+#define DEVICE_INTERRUPT        void vect_IRQ( void )
+
+PendSV_Exception;
+SVCall_Exception;
+TIMER_COMPARE_INTERRUPT;
+DEVICE_INTERRUPT;
+
+extern int hostActive;      // vector being handled (VECTACTIVE)
+
+#define DEVICE_IRQ_VECTOR(n)    VECTOR_ADDR(0x40 + ((n) << 2))
+#define ACTIVE_IRQ()            (hostActive - 16)
+
+#define __svc_dispatch(next)    { upcoming = (next); vect_SVCall(); }
+#define __pendSV_dispatch(next) { upcoming = (next); hostPend(PendSV_IRQn); }
+#define PENDSV_SET()            hostPend(PendSV_IRQn)
+void pendsv_mail( void);
+
+// TIM5 is the monotonic clock, its compare channels share a POSIX timer
+
+void TIMER_INIT( void);
+int32_t hostTimerGet( void);
+void hostTimerSet( int c, int32_t t);
+int hostCompared( int c);
+void hostTimerClear( int c);
+void hostTimerDisarm( int c);
+uint32_t hostCycles( void);
+
+#define TIMER_CCLR(c)       hostTimerClear(c)
+#define TIMER_OCLR()
+#define TIMER_COMPARED(c)   hostCompared(c)
+#define TIMER_OVERFLOWED()  0
+
+#define TIMERGET(x)     (x = hostTimerGet())
+#define TIMERSET(c, t)  (hostTimerSet(c, t))
+#define TIMER_ARM(c, t)     hostTimerSet(c, t)
+#define TIMER_DISARM(c)     hostTimerDisarm(c)
+#define CYCLES()        hostCycles()    // nanoseconds
+#define CYCLES_PER_SEC  1000000000
+
+#define __DMB()         __sync_synchronize()
+
+#ifdef __SIM
+void simExecuted( Method meth);     // execution time of meth passes
+#endif
+
+#endif
@@ -1,65 +1,99 @@
-#include "TinyTimber.h"
-#include "sciTinyTimber.h"
-
-void sci_init(Serial *self, int unused) {
-    self->count = self->head = self->tail = 0;
-
-	USART_ITConfig( USART1, USART_IT_RXNE, ENABLE);
-	USART_ITConfig( USART1, USART_IT_TXE, DISABLE);
-	NVIC_SetPriority( USART1_IRQn, __IRQ_PRIORITY);
-	NVIC_EnableIRQ( USART1_IRQn);
-  
-}
-
-static void outc(Serial *self, char c){
-    if (self->count < SCI_BUFSIZE) {
-        self->buf[self->head] = c;
-        self->head = (self->head + 1) % SCI_BUFSIZE;
-	    self->count++;
-    }
-//	else
-//		Should handle overflow;
-}
-
-void sci_write(Serial *self, char *p) {
-	if (self->count == 0)
-        USART_ITConfig( self->port, USART_IT_TXE, ENABLE);
-
-    while (*p != '\0') {
-        if (*p == '\n')
-            outc(self, '\r');
-        outc(self, *p++);
-    }
-}
-
-void sci_writechar(Serial *self, int c) {
-    if (self->count == 0)
-        USART_ITConfig( self->port, USART_IT_TXE, ENABLE);
-    outc(self, c);
-}
-
-int sci_interrupt(Serial *self, int unused) {
-    if (USART_GetFlagStatus( self->port, USART_FLAG_RXNE) == SET) {     // Data received
-		int c;
-		
-		c = USART_ReceiveData( self->port);
-		
-        if (self->obj) {
-			ASYNC(self->obj, self->meth, c);
-			doIRQSchedule = 1;
-		}
-    } 
-    
-    if (USART_GetFlagStatus(self->port, USART_FLAG_TXE) == SET) {       // Transmit buffer empty
-        if (self->count > 0) {
-            USART_SendData( self->port, self->buf[self->tail]);
-            self->tail = (self->tail + 1) % SCI_BUFSIZE;
-            self->count--;
-            if (self->count == 0)
-				USART_ITConfig( self->port, USART_IT_TXE, DISABLE);
-        } else {
-            USART_ITConfig( self->port, USART_IT_TXE, DISABLE);  
-        }
-    }
-	return 0;
-}
+#include "TinyTimber.h"
+#include "sciTinyTimber.h"
+
+void sci_init(Serial *self, int unused) {
+    if (self->mailbox)
+        MAILBOX_OPEN(self->mailbox);
+    self->count = self->head = self->tail = 0;
+
+	USART_ITConfig( USART1, USART_IT_RXNE, ENABLE);
+	USART_ITConfig( USART1, USART_IT_TXE, DISABLE);
+	NVIC_EnableIRQ( USART1_IRQn);
+  
+}
+
+static void outc(Serial *self, char c){
+    if (self->count < SCI_BUFSIZE) {
+        self->buf[self->head] = c;
+        self->head = (self->head + 1) % SCI_BUFSIZE;
+	    self->count++;
+    }
+//	else
+//		Should handle overflow;
+}
+
+void sci_write(Serial *self, char *p) {
+	if (self->count == 0)
+        USART_ITConfig( self->port, USART_IT_TXE, ENABLE);
+
+    while (*p != '\0') {
+        if (*p == '\n')
+            outc(self, '\r');
+        outc(self, *p++);
+    }
+}
+
+void sci_writechar(Serial *self, int c) {
+    if (self->count == 0)
+        USART_ITConfig( self->port, USART_IT_TXE, ENABLE);
+    outc(self, c);
+}
+
+#define SCI_TRACE_BATCH     8   // events per call, bounds the time spent here
+#define SCI_TRACE_RECORD    12
+
+static void outword(Serial *sci, uint32_t w) {
+    SCI_WRITECHAR(sci, w & 0xff);
+    SCI_WRITECHAR(sci, (w >> 8) & 0xff);
+    SCI_WRITECHAR(sci, (w >> 16) & 0xff);
+    SCI_WRITECHAR(sci, (w >> 24) & 0xff);
+}
+
+// Binary records of 12 bytes: 0xA5, type, thread, low byte of seq, then
+// cycles and arg as little endian words. Only as many events as fit in
+// the transmit buffer are taken from the trace ring; the rest wait for
+// the next call. The bytes go through sci_writechar, one short call on
+// the installed port each, so nothing here runs with interrupts masked
+// for longer than any other writer of the port.
+void sci_trace(SciTracer *self, int unused) {
+    TraceEvent e[SCI_TRACE_BATCH];
+    Serial *sci = self->sci;
+    int i, n = (SCI_BUFSIZE - sci->count) / SCI_TRACE_RECORD;   // other writers may take some
+    if (n > SCI_TRACE_BATCH)
+        n = SCI_TRACE_BATCH;
+    n = TRACE_READ(e, n);
+    for (i = 0; i < n; i++) {
+        SCI_WRITECHAR(sci, 0xA5);
+        SCI_WRITECHAR(sci, e[i].type);
+        SCI_WRITECHAR(sci, e[i].thread & 0xff);
+        SCI_WRITECHAR(sci, e[i].seq & 0xff);
+        outword(sci, e[i].cycles);
+        outword(sci, e[i].arg);
+    }
+}
+
+int sci_interrupt(Serial *self, int unused) {
+    if (USART_GetFlagStatus( self->port, USART_FLAG_RXNE) == SET) {     // Data received
+		int c;
+		
+		c = USART_ReceiveData( self->port);
+		
+        if (self->mailbox)
+            MAILBOX_POST(self->mailbox, c);                     // drop c if the mailbox is full
+        else if (self->obj && TRY_ASYNC(self->obj, self->meth, c))   // drop c if the pool runs low
+			doIRQSchedule = 1;
+    } 
+    
+    if (USART_GetFlagStatus(self->port, USART_FLAG_TXE) == SET) {       // Transmit buffer empty
+        if (self->count > 0) {
+            USART_SendData( self->port, self->buf[self->tail]);
+            self->tail = (self->tail + 1) % SCI_BUFSIZE;
+            self->count--;
+            if (self->count == 0)
+				USART_ITConfig( self->port, USART_IT_TXE, DISABLE);
+        } else {
+            USART_ITConfig( self->port, USART_IT_TXE, DISABLE);  
+        }
+    }
+	return 0;
+}